@@ -1,6 +1,12 @@
 bool register_cell_cmd(sta::LibertyCell *cell, bool verbose);
-void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve);
-void read_aiger_cmd(const char *filename, const char *name);
+void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve, bool adaptive,
+					int threads);
+void read_aiger_cmd(const char *filename, const char *name, bool strash, bool prepare,
+					int cuts, int matches, int max_cut, bool apply_sieve);
+void write_cut_checkpoint_cmd(const char *filename);
+void read_cut_checkpoint_cmd(const char *filename);
+void write_aiger_cmd(const char *filename, bool with_mapping);
+void restore_mapping_cmd();
 void portlist_cmd();
 void write_aig_verilog(const char *filename, const char *module_name);
 void report_mapping();
@@ -10,4 +16,8 @@ void report_aig();
 void lose_choices();
 void report_sibling_usage();
 void prune_targets_cmd();
-void sieve_cmd(bool dump, bool record, bool clear);
+void strash_cmd();
+void match_arena_cmd(int huge_pages, bool release);
+void sieve_cmd(bool dump, bool record, bool clear, const char *load);
+void learn_sieve_cmd(const char *dirname, const char *filename, int threads, float coverage,
+					int cuts, int matches, int max_cut);
@@ -1,43 +1,200 @@
 #include <algorithm>
-#include <functional>
 #include <bit>
-#include <set>
+#include <vector>
 
 #include <assert.h>
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
 #include "npn.h"
 
-truth6 cofactor_masks[6] = {
-	0xaaaaaaaaaaaaaaaa,
-	0xcccccccccccccccc,
-	0xf0f0f0f0f0f0f0f0,
-	0xff00ff00ff00ff00,
-	0xffff0000ffff0000,
-	0xffffffff00000000
-};
+const NPNTables npn_tables;
+
+NPNTables::NPNTables()
+{
+	int p[6] = {0, 1, 2, 3, 4, 5};
+	int idx = 0;
+	do {
+		std::copy(p, p + 6, perm[idx]);
+	} while (idx++, std::next_permutation(p, p + 6));
+	assert(idx == nperms);
+
+	for (int a = 0; a < nperms; a++) {
+		for (int b = 0; b < nperms; b++) {
+			int c[6];
+			for (int i = 0; i < 6; i++)
+				c[i] = perm[a][perm[b][i]];
+			compose[a][b] = rank(c);
+		}
+
+		int inv[6];
+		for (int i = 0; i < 6; i++)
+			inv[perm[a][i]] = i;
+		inverse[a] = rank(inv);
+
+		for (int x = 0; x < 64; x++) {
+			permute_phase[a][x] = 0;
+			for (int i = 0; i < 6; i++)
+				permute_phase[a][x] |= (x >> perm[a][i] & 1) << i;
+		}
+
+		// bring the variable destined for position k there, one
+		// position at a time
+		int cur[6] = {0, 1, 2, 3, 4, 5};
+		nswaps[a] = 0;
+		for (int k = 0; k < 6; k++) {
+			int pos = std::find(cur + k, cur + 6, inv[k]) - cur;
+			if (pos == k)
+				continue;
+			std::swap(cur[k], cur[pos]);
+			swaps[a][nswaps[a]][0] = k;
+			swaps[a][nswaps[a]][1] = pos;
+			nswaps[a]++;
+		}
+	}
+}
+
+int NPNTables::rank(const int p[6])
+{
+	static const int factorial[6] = {120, 24, 6, 2, 1, 1};
+	int ret = 0;
+	for (int i = 0; i < 6; i++) {
+		int smaller = 0;
+		for (int j = i + 1; j < 6; j++)
+			smaller += p[j] < p[i];
+		ret += smaller * factorial[i];
+	}
+	return ret;
+}
+
+int NPNTables::rank8(const int p[8])
+{
+	static const int factorial[8] = {5040, 720, 120, 24, 6, 2, 1, 1};
+	int ret = 0;
+	for (int i = 0; i < 8; i++) {
+		int smaller = 0;
+		for (int j = i + 1; j < 8; j++)
+			smaller += p[j] < p[i];
+		ret += smaller * factorial[i];
+	}
+	return ret;
+}
+
+void NPNTables::unrank8(int pidx, int p[8])
+{
+	static const int factorial[8] = {5040, 720, 120, 24, 6, 2, 1, 1};
+	int left[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+	for (int i = 0; i < 8; i++) {
+		int k = pidx / factorial[i] % (8 - i);
+		p[i] = left[k];
+		std::copy(left + k + 1, left + 8 - i, left + k);
+	}
+}
+
+NPN NPN::compose_wide(const NPN &other) const
+{
+	int a[max_inputs], b[max_inputs], c[max_inputs];
+	perm(a);
+	other.perm(b);
+	int ic_ = 0;
+	for (int i = 0; i < max_inputs; i++) {
+		c[i] = a[b[i]];
+		ic_ |= (ic() >> b[i] & 1) << i;
+	}
+	return make(oc() ^ other.oc(), ic_ ^ other.ic(), c, ninputs());
+}
 
-truth6 npn_semiclass(truth6 m, int ninputs, NPN &npn)
+NPN NPN::inv_wide() const
+{
+	int a[max_inputs], inv[max_inputs];
+	perm(a);
+	for (int i = 0; i < max_inputs; i++)
+		inv[a[i]] = i;
+	int ic_ = 0;
+	for (int i = 0; i < max_inputs; i++)
+		ic_ |= (ic() >> inv[i] & 1) << i;
+	return make(oc(), ic_, inv, ninputs());
+}
+
+const NPNExact npn_exact;
+
+// Calls `cb` with each transform of `ninputs` inputs
+template<typename F>
+static void npn_foreach(int ninputs, F cb)
+{
+	for (int pidx = 0; pidx < NPNTables::nperms; pidx++) {
+		// only permutations leaving the unused inputs in place
+		bool valid = true;
+		for (int i = ninputs; i < 6; i++)
+			valid &= npn_tables.perm[pidx][i] == i;
+		if (!valid)
+			continue;
+		for (int ic = 0; ic < 1 << ninputs; ic++)
+		for (int oc = 0; oc < 2; oc++)
+			cb(NPN::make(oc, ic, pidx, ninputs));
+	}
+}
+
+NPNExact::NPNExact()
+{
+	std::vector<std::pair<truth6, NPN>> orbit;
+
+	for (int n = 1; n <= max_inputs; n++) {
+		int nfuncs = 1 << (1 << n);
+		truth6 mask = mask6(n);
+		std::vector<bool> done(nfuncs);
+
+		for (int f = 0; f < nfuncs; f++) {
+			if (done[f])
+				continue;
+
+			orbit.clear();
+			npn_foreach(n, [&](NPN npn) {
+				orbit.emplace_back(npn(f) & mask, npn);
+			});
+			auto canon = *std::min_element(orbit.begin(), orbit.end(),
+				[](auto &a, auto &b) { return a.first < b.first; });
+
+			// the transform of f to g composed with the one taking
+			// f to the canonical form
+			for (auto [g, npn] : orbit) {
+				if (done[g])
+					continue;
+				done[g] = true;
+				entries[offset[n] + g] = Entry{(uint16_t) canon.first, canon.second * npn.inv()};
+			}
+		}
+	}
+}
+
+template<typename T>
+T npn_semiclass_heuristic(T m, int ninputs, NPN &npn)
 {
 	npn = NPN{};
+	bool oc = false;
 
 	if (!ninputs)
-		return 0;
+		return T{};
 
 	int nbits = 1 << ninputs;
-	truth6 mask = ((truth6) 2 << (nbits - 1)) - 1; // damn you, C++!
+	T mask = truth_mask<T>(ninputs);
 	m &= mask;
-	if (std::popcount(m) > nbits / 2) {
-		npn.oc = true;
+	int ones = truth_popcount(m);
+	if (ones > nbits / 2) {
+		oc = true;
 		m ^= mask;
+		ones = nbits - ones;
 	}
 
-	bool compls[6] = {};
-	int popcount[6];
-	int order[6];
+	bool compls[NPN::max_inputs] = {};
+	int popcount[NPN::max_inputs];
+	int order[NPN::max_inputs];
 
 	for (int i = 0; i < ninputs; i++) {
-		int nfactor = std::popcount(m & ~cofactor_masks[i]);
-		int pfactor = std::popcount(m & cofactor_masks[i]);
+		int pfactor = cofactor_popcount(m, i);
+		int nfactor = ones - pfactor;
 
 		if (nfactor > pfactor) {
 			std::swap(pfactor, nfactor);
@@ -59,61 +216,201 @@ truth6 npn_semiclass(truth6 m, int ninputs, NPN &npn)
 		order[j] = i;
 	}
 
-	truth6 sc = 0;
+	int ic = 0, p[NPN::max_inputs];
+	for (int i = 0; i < ninputs; i++) {
+		ic |= compls[i] << i;
+		p[order[i]] = i;
+	}
+	npn = NPN::make(oc, ic, p, ninputs);
 
-	for (int idx1 = 0; idx1 < nbits; idx1++) {
-		if (!(m & (truth6) 1 << idx1))
-			continue;
+	// m has had the output complement applied already
+	return NPN::make(false, ic, npn.pidx(), ninputs)(m);
+}
 
-		int idx2 = 0;
-		for (int j = 0; j < ninputs; j++) {
-			int pj = order[j];
-			if ((!!(idx1 & 1 << pj)) ^ compls[pj])
-				idx2 |= 1 << j;
-		}
+template truth6 npn_semiclass_heuristic(truth6, int, NPN &);
+template truthw<7> npn_semiclass_heuristic(truthw<7>, int, NPN &);
+template truth8 npn_semiclass_heuristic(truth8, int, NPN &);
+
+#if defined(__x86_64__)
+// Optimal sorting network on six elements, applied by the batched
+// canonizer to the inputs' sort keys and truth table variables alike
+static const int sort6_network[12][2] = {
+	{0, 5}, {1, 3}, {2, 4}, {1, 2}, {3, 4}, {0, 3},
+	{2, 5}, {0, 1}, {2, 3}, {4, 5}, {1, 2}, {3, 4}
+};
+
+__attribute__((target("avx2")))
+static inline __m256i popcount_epi64(__m256i v)
+{
+	const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+										 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, nibble));
+	__m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+	return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
 
-		sc |= (truth6) 1 << idx2;
+// Four lanes of npn_semiclass_heuristic() on functions of five or six
+// inputs. Ties in cofactor popcounts go to the lower input like in the
+// insertion sort of the scalar version, by keying on popcount * 8 + i.
+__attribute__((target("avx2")))
+static void npn_semiclass_heuristic_x4(const truth6 m_in[4], const int ninputs[4],
+									   truth6 semiclass[4], NPN npn[4])
+{
+	__m256i m = _mm256_loadu_si256((const __m256i *) m_in);
+	__m256i nin = _mm256_setr_epi64x(ninputs[0], ninputs[1], ninputs[2], ninputs[3]);
+	__m256i six = _mm256_cmpeq_epi64(nin, _mm256_set1_epi64x(6));
+	__m256i mask = _mm256_blendv_epi8(_mm256_set1_epi64x(0xffffffff), _mm256_set1_epi64x(-1), six);
+	__m256i half = _mm256_blendv_epi8(_mm256_set1_epi64x(16), _mm256_set1_epi64x(32), six);
+
+	m = _mm256_and_si256(m, mask);
+	__m256i oc = _mm256_cmpgt_epi64(popcount_epi64(m), half);
+	m = _mm256_xor_si256(m, _mm256_and_si256(mask, oc));
+
+	__m256i keys[6];
+	int ic[4] = {};
+	for (int i = 0; i < 6; i++) {
+		__m256i cm = _mm256_set1_epi64x(cofactor_masks[i]);
+		__m256i nfactor = popcount_epi64(_mm256_andnot_si256(cm, m));
+		__m256i pfactor = popcount_epi64(_mm256_and_si256(cm, m));
+		__m256i compl_ = _mm256_cmpgt_epi64(nfactor, pfactor);
+		__m256i used = _mm256_cmpgt_epi64(nin, _mm256_set1_epi64x(i));
+		compl_ = _mm256_and_si256(compl_, used);
+
+		__m256i key = _mm256_blendv_epi8(nfactor, pfactor, compl_);
+		key = _mm256_blendv_epi8(_mm256_set1_epi64x(128), key, used);
+		keys[i] = _mm256_add_epi64(_mm256_slli_epi64(key, 3), _mm256_set1_epi64x(i));
+
+		__m128i shift = _mm_cvtsi32_si128(1 << i);
+		__m256i flipped = _mm256_or_si256(_mm256_srl_epi64(_mm256_and_si256(m, cm), shift),
+										  _mm256_sll_epi64(_mm256_andnot_si256(cm, m), shift));
+		m = _mm256_blendv_epi8(m, flipped, compl_);
+
+		int bits = _mm256_movemask_pd(_mm256_castsi256_pd(compl_));
+		for (int lane = 0; lane < 4; lane++)
+			ic[lane] |= (bits >> lane & 1) << i;
 	}
 
-	for (int i = 0; i < ninputs; i++) {
-		npn.ic[i] = compls[i];
-		npn.p[order[i]] = i;
+	for (auto [a, b] : sort6_network) {
+		__m256i gt = _mm256_cmpgt_epi64(keys[a], keys[b]);
+		__m256i ka = keys[a];
+		keys[a] = _mm256_blendv_epi8(ka, keys[b], gt);
+		keys[b] = _mm256_blendv_epi8(keys[b], ka, gt);
+
+		int shift = (1 << b) - (1 << a);
+		__m256i move = _mm256_set1_epi64x(cofactor_masks[a] & ~cofactor_masks[b]);
+		__m128i shiftv = _mm_cvtsi32_si128(shift);
+		__m256i stay = _mm256_andnot_si256(_mm256_or_si256(move, _mm256_sll_epi64(move, shiftv)), m);
+		__m256i swapped = _mm256_or_si256(stay,
+			_mm256_or_si256(_mm256_sll_epi64(_mm256_and_si256(m, move), shiftv),
+							_mm256_and_si256(_mm256_srl_epi64(m, shiftv), move)));
+		m = _mm256_blendv_epi8(m, swapped, gt);
 	}
 
-	return sc;
+	_mm256_storeu_si256((__m256i *) semiclass, m);
+
+	uint64_t order[6][4];
+	for (int i = 0; i < 6; i++)
+		_mm256_storeu_si256((__m256i *) order[i], keys[i]);
+	int oc_bits = _mm256_movemask_pd(_mm256_castsi256_pd(oc));
+	for (int lane = 0; lane < 4; lane++) {
+		int p[6];
+		for (int j = 0; j < ninputs[lane]; j++)
+			p[order[j][lane] & 7] = j;
+		npn[lane] = NPN::make(oc_bits >> lane & 1, ic[lane], p, ninputs[lane]);
+	}
 }
+#endif
 
-void npn_semiclass_allrepr(truth6 m, int ninputs,
-						   std::function<void(truth6, NPN&)> cb)
+void npn_semiclass_batch(const truth6 *m, const int *ninputs, int n,
+						 truth6 *semiclass, NPN *npn)
 {
-	NPN npn = {};
+	int i = 0;
+
+#if defined(__x86_64__)
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if (avx2) {
+		truth6 lane_m[4], lane_sc[4];
+		int lane_nin[4], lane_idx[4];
+		NPN lane_npn[4];
+		int nlanes = 0;
+
+		auto flush = [&]() {
+			// pad with copies of the first lane
+			for (int lane = nlanes; lane < 4; lane++) {
+				lane_m[lane] = lane_m[0];
+				lane_nin[lane] = lane_nin[0];
+			}
+			npn_semiclass_heuristic_x4(lane_m, lane_nin, lane_sc, lane_npn);
+			for (int lane = 0; lane < nlanes; lane++) {
+				semiclass[lane_idx[lane]] = lane_sc[lane];
+				npn[lane_idx[lane]] = lane_npn[lane];
+			}
+			nlanes = 0;
+		};
 
-	if (!ninputs) {
-		cb(0, npn);
+		for (; i < n; i++) {
+			if (ninputs[i] <= NPNExact::max_inputs) {
+				semiclass[i] = npn_semiclass(m[i], ninputs[i], npn[i]);
+				continue;
+			}
+			lane_m[nlanes] = m[i];
+			lane_nin[nlanes] = ninputs[i];
+			lane_idx[nlanes++] = i;
+			if (nlanes == 4)
+				flush();
+		}
+		if (nlanes)
+			flush();
+	}
+#endif
+
+	for (; i < n; i++)
+		semiclass[i] = npn_semiclass(m[i], ninputs[i], npn[i]);
+}
+
+template<typename T>
+NPNReprs<T>::NPNReprs(T m, int ninputs)
+	: ninputs(ninputs)
+{
+	if (!ninputs)
 		return;
+
+	mask = truth_mask<T>(ninputs);
+	this->m = m & mask;
+
+	if constexpr (std::is_same_v<T, truth6>) {
+		if (ninputs <= NPNExact::max_inputs) {
+			canon = npn_exact.lookup(m, ninputs).canon;
+			for (int i = 0; i < NPN::max_inputs; i++)
+				order[i] = i;
+			return;
+		}
 	}
 
-	bool bipo = false;
 	int nbits = 1 << ninputs;
-	truth6 mask = ((truth6) 2 << (nbits - 1)) - 1; // damn you, C++!
-	m &= mask;
-	if (std::popcount(m) > nbits / 2) {
-		npn.oc = true;
-		m ^= mask;
-	} else if (std::popcount(m) == nbits / 2) {
+	if (truth_popcount(this->m) > nbits / 2) {
+		oc = true;
+		this->m ^= mask;
+	} else if (truth_popcount(this->m) == nbits / 2) {
 		bipo = true;
 	}
+	polarize();
+}
 
-repolarize:
-	bool compls[6] = {};
-	int popcount[6];
-	int order[6];
-	int ambimask = nbits - 1;
+template<typename T>
+void NPNReprs<T>::polarize()
+{
+	int popcount[NPN::max_inputs];
+	ambimask = (1 << ninputs) - 1;
+	ambi = 0;
 
+	int ones = truth_popcount(m);
 	for (int i = 0; i < ninputs; i++) {
-		int nfactor = std::popcount(m & ~cofactor_masks[i]);
-		int pfactor = std::popcount(m & cofactor_masks[i]);
+		int pfactor = cofactor_popcount(m, i);
+		int nfactor = ones - pfactor;
 
+		compls[i] = false;
 		if (nfactor > pfactor) {
 			std::swap(pfactor, nfactor);
 			compls[i] = true;
@@ -136,109 +433,96 @@ repolarize:
 		order[j] = i;
 	}
 
-	int tied[6] = {};
-
+	std::fill(std::begin(tied), std::end(tied), 0);
 	for (int i = 0; i < ninputs - 1; i++) {
 		int mark = i;
-		for (; popcount[i] == popcount[i + 1] && i < ninputs - 1;) {
+		for (; i < ninputs - 1 && popcount[i] == popcount[i + 1];) {
 			tied[mark]++; i++;
 		}
 	}
+}
 
-	for (int ambi = 0; ambi < nbits; ambi = ((ambi | ambimask) + 1) & ~ambimask)
-	{
-next_round:
-		{
-			truth6 sc = 0;
-			for (int idx1 = 0; idx1 < nbits; idx1++) {
-				if (!(m & (truth6) 1 << idx1))
-					continue;
-
-				int idx2 = 0;
-				for (int j = 0; j < ninputs; j++) {
-					int pj = order[j];
-					if ((!!(idx1 & 1 << pj)) ^ compls[pj] ^ !!(ambi & 1 << pj))
-						idx2 |= 1 << j;
-				}
-
-				sc |= (truth6) 1 << idx2;
-			}
-
-
-			for (int i = 0; i < ninputs; i++) {
-				npn.ic[i] = compls[i] ^ !!(ambi & 1 << i);
-				npn.p[order[i]] = i;
-			}
+// Steps through the orderings of tied inputs first, then through the
+// polarities of ambivalent inputs, and finally over to the complement
+// of a balanced function
+template<typename T>
+bool NPNReprs<T>::advance()
+{
+	for (int j = ninputs - 2; j >= 0; j--)
+	if (tied[j]) {
+		if (std::next_permutation(std::begin(order) + j,
+								  std::begin(order) + j + tied[j] + 1))
+			return true;
+	}
 
-			cb(sc, npn);
-		}
+	ambi = ((ambi | ambimask) + 1) & ~ambimask;
+	if (ambi < 1 << ninputs)
+		return true;
 
-		for (int j = ninputs - 2; j >= 0; j--)
-		if (tied[j]) {
-			if (std::next_permutation(std::begin(order) + j,
-									  std::begin(order) + j + tied[j] + 1))
-				goto next_round;
-		}
-	}
 	if (bipo) {
 		bipo = false;
 		m ^= mask;
-		npn.oc ^= true;
-		goto repolarize;
+		oc ^= true;
+		polarize();
+		return true;
 	}
+	return false;
 }
 
-#ifdef NPN_MAIN
-int main(int argc, char const *argv[])
+template<typename T>
+bool NPNReprs<T>::next(T &repr, NPN &npn)
 {
-	int K = atoi(argv[1]);
-	printf("Classifying functions of %d inputs\n", K);
-
-	std::set<truth6> seen;
-	int unique = 0;
-	truth6 mask = ((truth6) 2 << (K - 1)) - 1;
-
-	for (uint64_t i = 0; i < (uint64_t) 1 << (1 << K); i++) {
-		NPN npn;
-
-		truth6 sc = npn_semiclass(i, K, npn);
-
-		assert((npn(i) & mask) == (sc & mask));
-		assert(((npn.inv())(sc) & mask) == (i & mask));
-		assert((npn.inv() * npn).is_identity());
-		assert((npn * npn.inv()).is_identity());
-
-		if (seen.count(sc))
-			continue;
-
-		unique++;
-
-		bool found = false;
-		npn_semiclass_allrepr(i, K, [&](truth6 sc_any, NPN &npn_any) {
-
-			assert((npn_any(i) & mask) == (sc_any & mask));
-			assert(((npn_any.inv())(sc_any) & mask) == (i & mask));
+	if (done)
+		return false;
 
-			seen.insert(sc_any);
-			if (sc == sc_any)
-				found = true;
-		});
-		assert(found);
+	if (!ninputs) {
+		done = true;
+		repr = T{};
+		npn = NPN{};
+		return true;
 	}
 
-	printf("Found %d unique classes\n", unique);
+	if constexpr (std::is_same_v<T, truth6>) {
+		if (ninputs <= NPNExact::max_inputs) {
+			// try all transforms, the output complement changing fastest
+			// and the permutation slowest
+			while (true) {
+				if (fresh) {
+					fresh = false;
+				} else if ((oc = !oc)) {
+				} else if (++exact_ic == 1 << ninputs) {
+					exact_ic = 0;
+					if (!std::next_permutation(order, order + ninputs)) {
+						done = true;
+						return false;
+					}
+				}
 
-	return 0;
-}
-#endif
+				npn = NPN::make(oc, exact_ic, order, ninputs);
+				if ((npn(m) & mask) == canon) {
+					repr = canon;
+					return true;
+				}
+			}
+		}
+	}
 
-#ifdef NPN_MAIN2
-int main(int argc, char const *argv[])
-{
-	printf("Class %llx\n", npn_semiclass(0xff00000000000000, 6));
+	if (fresh) {
+		fresh = false;
+	} else if (!advance()) {
+		done = true;
+		return false;
+	}
 
-	return 0;
+	int ic = 0, p[NPN::max_inputs];
+	for (int i = 0; i < ninputs; i++) {
+		ic |= (compls[i] ^ !!(ambi & 1 << i)) << i;
+		p[order[i]] = i;
+	}
+	npn = NPN::make(oc, ic, p, ninputs);
+	repr = NPN::make(false, ic, npn.pidx(), ninputs)(m);
+	return true;
 }
-#endif
-
 
+template class NPNReprs<truth6>;
+template class NPNReprs<truth8>;
@@ -1,86 +1,457 @@
+#include <bit>
+#include <compare>
+#include <cstdint>
+#include <cstdio>
+#include <type_traits>
+#include <utility>
 
 typedef uint64_t truth6;
 
+inline constexpr truth6 cofactor_masks[6] = {
+	0xaaaaaaaaaaaaaaaa,
+	0xcccccccccccccccc,
+	0xf0f0f0f0f0f0f0f0,
+	0xff00ff00ff00ff00,
+	0xffff0000ffff0000,
+	0xffffffff00000000
+};
+
+inline truth6 mask6(int n) {
+	return ~(truth6) 0 >> (64 - (1 << n));
+}
+
+// Exchanges variables i < j of a truth table
+inline truth6 swap_vars(truth6 m, int i, int j)
+{
+	int shift = (1 << j) - (1 << i);
+	truth6 move = cofactor_masks[i] & ~cofactor_masks[j];
+	return (m & ~(move | move << shift)) | (m & move) << shift | (m >> shift & move);
+}
+
+// Complements variable i of a truth table
+inline truth6 flip_var(truth6 m, int i)
+{
+	int shift = 1 << i;
+	return (m & cofactor_masks[i]) >> shift | (m & ~cofactor_masks[i]) << shift;
+}
+
+// Truth table of a function of seven or more inputs, the variables past
+// the sixth selecting among the words. Bits past the function's inputs
+// are kept clear.
+template<int K>
+struct truthw {
+	static_assert(K > 6 && K <= 8);
+	static constexpr int nwords = 1 << (K - 6);
+	uint64_t w[nwords] = {};
+
+	truthw() = default;
+	explicit truthw(truth6 low)	{ w[0] = low; }
+
+	template<int K2>
+	explicit truthw(const truthw<K2> &other)
+	{
+		for (int i = 0; i < nwords && i < other.nwords; i++)
+			w[i] = other.w[i];
+	}
+
+	static truthw mask(int ninputs)
+	{
+		truthw ret;
+		if (ninputs <= 6)
+			ret.w[0] = mask6(ninputs);
+		else
+			for (int i = 0; i < 1 << (ninputs - 6); i++)
+				ret.w[i] = ~(uint64_t) 0;
+		return ret;
+	}
+
+	truthw &operator&=(const truthw &o)	{ for (int i = 0; i < nwords; i++) w[i] &= o.w[i]; return *this; }
+	truthw &operator|=(const truthw &o)	{ for (int i = 0; i < nwords; i++) w[i] |= o.w[i]; return *this; }
+	truthw &operator^=(const truthw &o)	{ for (int i = 0; i < nwords; i++) w[i] ^= o.w[i]; return *this; }
+	truthw operator&(const truthw &o) const	{ truthw r = *this; return r &= o; }
+	truthw operator|(const truthw &o) const	{ truthw r = *this; return r |= o; }
+	truthw operator^(const truthw &o) const	{ truthw r = *this; return r ^= o; }
+	truthw operator~() const
+	{
+		truthw r;
+		for (int i = 0; i < nwords; i++)
+			r.w[i] = ~w[i];
+		return r;
+	}
+
+	auto operator<=>(const truthw &) const = default;
+};
+
+typedef truthw<8> truth8;
+
+// The table type for functions of up to K inputs
+template<int K>
+using truth_t = std::conditional_t<(K <= 6), truth6, truthw<K>>;
+
+template<int K>
+truthw<K> swap_vars(const truthw<K> &m, int i, int j)
+{
+	truthw<K> ret;
+	if (j < 6) {
+		for (int k = 0; k < m.nwords; k++)
+			ret.w[k] = swap_vars(m.w[k], i, j);
+	} else if (i >= 6) {
+		int bi = 1 << (i - 6), bj = 1 << (j - 6);
+		for (int k = 0; k < m.nwords; k++)
+			ret.w[k] = m.w[!(k & bi) != !(k & bj) ? k ^ bi ^ bj : k];
+	} else {
+		// exchange the upper half of variable i in the words where j is
+		// clear with the lower half where j is set
+		int shift = 1 << i, bj = 1 << (j - 6);
+		truth6 cm = cofactor_masks[i];
+		for (int k = 0; k < m.nwords; k++) {
+			if (k & bj)
+				continue;
+			truth6 a = m.w[k], b = m.w[k | bj];
+			ret.w[k] = (a & ~cm) | (b & ~cm) << shift;
+			ret.w[k | bj] = (b & cm) | (a & cm) >> shift;
+		}
+	}
+	return ret;
+}
+
+template<int K>
+truthw<K> flip_var(const truthw<K> &m, int i)
+{
+	truthw<K> ret;
+	for (int k = 0; k < m.nwords; k++)
+		ret.w[k] = i < 6 ? flip_var(m.w[k], i) : m.w[k ^ 1 << (i - 6)];
+	return ret;
+}
+
+// Helpers letting the canonization code take either kind of table
+template<typename T>
+inline T truth_mask(int ninputs)
+{
+	if constexpr (std::is_same_v<T, truth6>)
+		return mask6(ninputs);
+	else
+		return T::mask(ninputs);
+}
+
+inline int truth_popcount(truth6 m)		{ return std::popcount(m); }
+
+template<int K>
+int truth_popcount(const truthw<K> &m)
+{
+	int ret = 0;
+	for (int k = 0; k < m.nwords; k++)
+		ret += std::popcount(m.w[k]);
+	return ret;
+}
+
+// Number of minterms with variable i set
+inline int cofactor_popcount(truth6 m, int i)	{ return std::popcount(m & cofactor_masks[i]); }
+
+template<int K>
+int cofactor_popcount(const truthw<K> &m, int i)
+{
+	int ret = 0;
+	for (int k = 0; k < m.nwords; k++) {
+		if (i < 6)
+			ret += std::popcount(m.w[k] & cofactor_masks[i]);
+		else if (k & 1 << (i - 6))
+			ret += std::popcount(m.w[k]);
+	}
+	return ret;
+}
+
+// Permutations of six inputs are referred to by their lexicographic
+// index, inputs past `ninputs` of a transform being left in place
+struct NPNTables {
+	static constexpr int nperms = 720;
+
+	uint8_t perm[nperms][6];
+	uint16_t compose[nperms][nperms]; // index of i -> a[b[i]]
+	uint16_t inverse[nperms];
+	uint8_t permute_phase[nperms][64]; // bit i of the result is bit perm[i]
+	// Transpositions of truth table variables which carry out the
+	// permutation, lower variable first
+	uint8_t nswaps[nperms];
+	uint8_t swaps[nperms][5][2];
+
+	NPNTables();
+	static int rank(const int p[6]);
+
+	// Lexicographic index among the permutations of eight inputs, which
+	// is how transforms of more than six inputs refer to theirs
+	static constexpr int nperms8 = 40320;
+	static int rank8(const int p[8]);
+	static void unrank8(int pidx, int p[8]);
+};
+
+extern const NPNTables npn_tables;
+
+// Packed as the output complement at bit 0, input complements at bits
+// 1 to 8, permutation index at bits 9 to 24 and the number of inputs
+// at bits 25 to 28. Up to six inputs the permutation index is the one
+// of NPNTables and the operations are table lookups; wider transforms
+// index the permutations of eight inputs and are computed.
 struct NPN {
-	bool oc = false;
-	bool ic[6] = {};
-	int p[6] = {-1, -1, -1, -1, -1, -1};
+	static constexpr int max_inputs = 8;
 
-	static NPN identity(int ninputs) {
+	uint32_t word = 0;
+
+	static NPN make(bool oc, int ic, int pidx, int ninputs)
+	{
 		NPN ret;
-		for (int i = 0; i < ninputs; i++)
-			ret.p[i] = i;
+		ret.word = oc | ic << 1 | pidx << 9 | ninputs << 25;
 		return ret;
 	}
 
-	bool is_identity() const
+	// `p` needs to be a permutation of the first `ninputs` inputs
+	static NPN make(bool oc, int ic, const int p[], int ninputs)
 	{
-		if (oc)
-			return false;
-		for (int i = 0; i < 6 && p[i] != -1; i++)
-		if (p[i] != i || ic[i])
-			return false;
-		return true;
+		int full[max_inputs];
+		for (int i = 0; i < max_inputs; i++)
+			full[i] = i < ninputs ? p[i] : i;
+		return make(oc, ic, ninputs > 6 ? NPNTables::rank8(full)
+										: NPNTables::rank(full), ninputs);
 	}
 
-	int ninputs() const
+	static NPN identity(int ninputs)	{ return make(false, 0, 0, ninputs); }
+
+	bool oc() const						{ return word & 1; }
+	int ic() const						{ return word >> 1 & 255; }
+	bool ic(int i) const				{ return word >> (1 + i) & 1; }
+	int pidx() const					{ return word >> 9 & 0xffff; }
+	int ninputs() const					{ return word >> 25 & 15; }
+	bool wide() const					{ return word >= 7u << 25; }
+	bool is_identity() const			{ return !(word & ~(15u << 25)); }
+
+	int p(int i) const
 	{
-		int j;
-		for (j = 0; j < 6 && p[j] != -1; j++);
-		return j;
+		if (i >= ninputs())
+			return -1;
+		if (!wide())
+			return npn_tables.perm[pidx()][i];
+		int full[max_inputs];
+		NPNTables::unrank8(pidx(), full);
+		return full[i];
 	}
 
-	truth6 operator()(truth6 m) const {
-		truth6 ret = 0;
-		for (int idx1 = 0; idx1 < (1 << ninputs()); idx1++) {
-			if (!(m & (truth6) 1 << idx1))
-				continue;
-			int idx2 = 0;
-			for (int j = 0; j < ninputs(); j++) {
-				if ((!!(idx1 & 1 << j)) ^ ic[j])
-					idx2 |= 1 << p[j];
-			}
-			ret |= (truth6) 1 << idx2;
+	truth6 operator()(truth6 m) const
+	{
+		m &= mask6(ninputs());
+
+		for (int i = 0, c = ic(); c; i++, c >>= 1) {
+			if (c & 1)
+				m = flip_var(m, i);
 		}
-		return oc ? ~ret : ret;
+
+		int pi = pidx();
+		for (int k = 0; k < npn_tables.nswaps[pi]; k++)
+			m = swap_vars(m, npn_tables.swaps[pi][k][0], npn_tables.swaps[pi][k][1]);
+
+		return oc() ? ~m : m;
 	}
 
-	NPN operator*(const NPN &other)
+	template<int K>
+	truthw<K> operator()(truthw<K> m) const
 	{
-		NPN ret;
-		ret.oc = oc ^ other.oc;
-		for (int i = 0; i < 6 && p[i] != -1; i++) {
-			ret.p[i] = p[other.p[i]];
-			ret.ic[i] = ic[other.p[i]] ^ other.ic[i];
+		auto mask = truthw<K>::mask(ninputs());
+		m &= mask;
+
+		for (int i = 0, c = ic(); c; i++, c >>= 1) {
+			if (c & 1)
+				m = flip_var(m, i);
 		}
-		return ret;
+
+		// same as the swaps of NPNTables
+		int full[max_inputs], inv[max_inputs], cur[max_inputs];
+		perm(full);
+		for (int i = 0; i < max_inputs; i++) {
+			inv[full[i]] = i;
+			cur[i] = i;
+		}
+		for (int k = 0; k < ninputs(); k++) {
+			int pos = k;
+			while (cur[pos] != inv[k])
+				pos++;
+			if (pos == k)
+				continue;
+			std::swap(cur[k], cur[pos]);
+			m = swap_vars(m, k, pos);
+		}
+
+		return oc() ? ~m & mask : m;
+	}
+
+	NPN operator*(const NPN &other) const
+	{
+		if (wide() || other.wide())
+			return compose_wide(other);
+		int opi = other.pidx();
+		return make(oc() ^ other.oc(),
+					npn_tables.permute_phase[opi][ic()] ^ other.ic(),
+					npn_tables.compose[pidx()][opi], ninputs());
 	}
 
-	void dump()
+	void dump() const
 	{
-		printf("%s(", oc ? "#" : "");
-		for (int i = 0; i < 6 && p[i] != -1; i++)
-			printf("%s%d->%d%s", i != 0 ? " " : "", i, p[i], ic[i] ? "#" : "");
+		printf("%s(", oc() ? "#" : "");
+		for (int i = 0; i < ninputs(); i++)
+			printf("%s%d->%d%s", i != 0 ? " " : "", i, p(i), ic(i) ? "#" : "");
 		printf(")\n");
 	}
 
-	NPN inv()
+	NPN inv() const
 	{
-		NPN ret;
-		ret.oc = oc;
-		for (int i = 0; i < 6 && p[i] != -1; i++) {
-			ret.p[p[i]] = i;
-			ret.ic[p[i]] = ic[i];
-		}
+		if (wide())
+			return inv_wide();
+		int ipi = npn_tables.inverse[pidx()];
+		return make(oc(), npn_tables.permute_phase[ipi][ic()], ipi, ninputs());
+	}
+
+	// Compact form for storing in files: oc and ic[] bits followed
+	// by p[] in 3-bit fields with 7 standing for -1. Wide transforms
+	// don't fit that and are stored as the word flagged by bit 31.
+	uint32_t pack() const
+	{
+		if (wide())
+			return word | 1u << 31;
+		uint32_t ret = word & 127;
+		for (int i = 0; i < 6; i++)
+			ret |= (uint32_t) (p(i) & 7) << (7 + 3 * i);
 		return ret;
 	}
 
-	int c_fingerprint()
+	static NPN unpack(uint32_t packed)
 	{
-		return oc | ic[0] << 1 | ic[1] << 2 | ic[2] << 3 | ic[3] << 4 | ic[4] << 5 | ic[5] << 6;
+		if (packed >> 31) {
+			NPN ret;
+			ret.word = packed & ~(1u << 31);
+			return ret;
+		}
+		int p[6], n;
+		for (n = 0; n < 6 && (packed >> (7 + 3 * n) & 7) != 7; n++)
+			p[n] = packed >> (7 + 3 * n) & 7;
+		return make(packed & 1, packed >> 1 & 63, p, n);
+	}
+
+	int c_fingerprint() const			{ return word & 511; }
+
+private:
+	// Fills in all max_inputs entries, unused inputs staying in place
+	void perm(int full[max_inputs]) const
+	{
+		if (wide()) {
+			NPNTables::unrank8(pidx(), full);
+			return;
+		}
+		for (int i = 0; i < max_inputs; i++)
+			full[i] = i < 6 ? npn_tables.perm[pidx()][i] : i;
 	}
+
+	NPN compose_wide(const NPN &other) const;
+	NPN inv_wide() const;
+};
+
+// Exact canonical forms of all functions of up to four inputs, that
+// is the smallest truth table among the NPN class, along with a
+// transform taking each function there
+struct NPNExact {
+	static constexpr int max_inputs = 4;
+	static constexpr int offset[max_inputs + 1] = {0, 0, 4, 20, 276};
+	static constexpr int nentries = 276 + 65536;
+
+	struct Entry {
+		uint16_t canon;
+		NPN npn;
+	};
+	Entry entries[nentries];
+
+	NPNExact();
+
+	const Entry &lookup(truth6 m, int ninputs) const
+	{
+		return entries[offset[ninputs] + (m & mask6(ninputs))];
+	}
+};
+
+extern const NPNExact npn_exact;
+
+template<typename T>
+T npn_semiclass_heuristic(T m, int ninputs, NPN &npn);
+
+extern template truth6 npn_semiclass_heuristic(truth6, int, NPN &);
+extern template truthw<7> npn_semiclass_heuristic(truthw<7>, int, NPN &);
+extern template truth8 npn_semiclass_heuristic(truth8, int, NPN &);
+
+inline truth6 npn_semiclass(truth6 m, int ninputs, NPN &npn)
+{
+	if (ninputs && ninputs <= NPNExact::max_inputs) {
+		auto &entry = npn_exact.lookup(m, ninputs);
+		npn = entry.npn;
+		return entry.canon;
+	}
+	return npn_semiclass_heuristic(m, ninputs, npn);
+}
+
+// Functions of up to six inputs held in a wide table get the semiclass
+// they get as a truth6, so that the two agree on the class
+template<int K>
+truthw<K> npn_semiclass(const truthw<K> &m, int ninputs, NPN &npn)
+{
+	if (ninputs <= 6)
+		return truthw<K>(npn_semiclass(m.w[0], ninputs, npn));
+	return npn_semiclass_heuristic(m, ninputs, npn);
+}
+
+// Canonizes `n` functions at once like npn_semiclass(), with the ones
+// taking the heuristic processed four at a time where AVX2 is available
+void npn_semiclass_batch(const truth6 *m, const int *ninputs, int n,
+						 truth6 *semiclass, NPN *npn);
+
+// Enumerates the representatives of the semiclass of a function, each
+// along with a transform taking the function there. Functions of up to
+// NPNExact::max_inputs inputs have the single exact representative,
+// possibly reached by many transforms. Wide tables are meant for more
+// than six inputs.
+template<typename T = truth6>
+class NPNReprs {
+public:
+	NPNReprs(T m, int ninputs);
+	bool next(T &repr, NPN &npn);
+
+private:
+	void polarize();
+	bool advance();
+
+	T m = {}, mask = {};
+	truth6 canon = 0;
+	int ninputs;
+	bool oc = false, bipo = false;
+	bool fresh = true, done = false;
+	bool compls[NPN::max_inputs] = {};
+	int order[NPN::max_inputs];
+	int tied[NPN::max_inputs] = {};
+	int ambimask = 0, ambi = 0;
+	int exact_ic = 0;
 };
 
-truth6 npn_semiclass(truth6 m, int ninputs, NPN &npn);
-void npn_semiclass_allrepr(truth6 m, int ninputs,
-						   std::function<void(truth6, NPN&)> cb);
+extern template class NPNReprs<truth6>;
+extern template class NPNReprs<truth8>;
+
+// Calls `cb` with each representative. A callback returning bool can
+// stop the enumeration early by returning false.
+template<typename T, typename F>
+void npn_semiclass_allrepr(T m, int ninputs, F &&cb)
+{
+	NPNReprs<T> reprs(m, ninputs);
+	T repr;
+	NPN npn;
+	while (reprs.next(repr, npn)) {
+		if constexpr (std::is_same_v<decltype(cb(repr, npn)), bool>) {
+			if (!cb(repr, npn))
+				return;
+		} else {
+			cb(repr, npn);
+		}
+	}
+}
@@ -0,0 +1,252 @@
+//
+// npn_check -- verification and throughput of the NPN canonization
+//
+// Exhaustively checks the canonization of all functions of up to four
+// inputs, and of random functions past that, then with `-bench` times
+// the canonizers. Each result is printed on a line of its own as the
+// record kind followed by key=value fields.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "npn.h"
+
+static int nfailures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		if (nfailures++ < 10) \
+			printf("fail line=%d cond=\"%s\"\n", __LINE__, #cond); \
+	} \
+} while (0)
+
+static std::mt19937_64 rng;
+static volatile bool keep; // defeats dead code elimination in the benchmarks
+
+static NPN random_npn(int ninputs)
+{
+	int p[NPN::max_inputs];
+	for (int i = 0; i < ninputs; i++)
+		p[i] = i;
+	std::shuffle(p, p + ninputs, rng);
+	return NPN::make(rng() & 1, rng() & ((1 << ninputs) - 1), p, ninputs);
+}
+
+template<typename T>
+static T random_function(int ninputs)
+{
+	T m;
+	if constexpr (std::is_same_v<T, truth6>) {
+		m = rng();
+	} else {
+		for (auto &word : m.w)
+			word = rng();
+	}
+	return m & truth_mask<T>(ninputs);
+}
+
+// Checks the transform returned along with the semiclass, and that the
+// semiclass of any other member of the class is one of the function's
+// representatives, which is what finding a match relies on
+template<typename T>
+static void check_function(T m, int ninputs, const std::set<T> &reprs)
+{
+	T mask = truth_mask<T>(ninputs);
+	NPN npn;
+	T sc = npn_semiclass(m, ninputs, npn);
+
+	CHECK((npn(m) & mask) == sc);
+	CHECK((npn.inv()(sc) & mask) == m);
+	CHECK((npn.inv() * npn).is_identity());
+	CHECK((npn * npn.inv()).is_identity());
+	CHECK(NPN::unpack(npn.pack()).word == npn.word);
+	CHECK(reprs.count(sc));
+
+	NPN q = random_npn(ninputs);
+	NPN npn2;
+	T sc2 = npn_semiclass(q(m) & mask, ninputs, npn2);
+	CHECK(reprs.count(sc2));
+	CHECK(((npn2 * q)(m) & mask) == sc2);
+}
+
+template<typename T>
+static std::set<T> representatives(T m, int ninputs)
+{
+	T mask = truth_mask<T>(ninputs);
+	std::set<T> reprs;
+	npn_semiclass_allrepr(m, ninputs, [&](T repr, NPN &npn) {
+		CHECK((npn(m) & mask) == repr);
+		CHECK((npn.inv()(repr) & mask) == m);
+		reprs.insert(repr);
+	});
+	return reprs;
+}
+
+static void check_exhaustive(int ninputs)
+{
+	static const int nclasses[] = {1, 2, 4, 14, 222};
+	truth6 mask = mask6(ninputs);
+	std::set<truth6> seen;
+	int unique = 0;
+
+	for (uint64_t m = 0; m < (uint64_t) 1 << (1 << ninputs); m++) {
+		NPN npn;
+		truth6 sc = npn_semiclass(m, ninputs, npn);
+		if (!seen.count(sc)) {
+			unique++;
+			for (auto repr : representatives<truth6>(m, ninputs))
+				seen.insert(repr);
+		}
+		check_function<truth6>(m, ninputs, {sc});
+
+		// the exact canonical form is the smallest in the class
+		NPN q = random_npn(ninputs);
+		CHECK(sc <= (q(m) & mask));
+	}
+
+	CHECK(unique == nclasses[ninputs]);
+	printf("check kind=exhaustive k=%d functions=%llu classes=%d\n", ninputs,
+		   (unsigned long long) 1 << (1 << ninputs), unique);
+}
+
+template<typename T>
+static void check_random(int ninputs, int nsamples)
+{
+	for (int i = 0; i < nsamples; i++) {
+		T m = random_function<T>(ninputs);
+		check_function<T>(m, ninputs, representatives<T>(m, ninputs));
+	}
+	printf("check kind=random k=%d functions=%d\n", ninputs, nsamples);
+}
+
+static void check_batch(int nsamples)
+{
+	std::vector<truth6> m(nsamples), sc(nsamples);
+	std::vector<int> ninputs(nsamples);
+	std::vector<NPN> npn(nsamples);
+	for (int i = 0; i < nsamples; i++) {
+		ninputs[i] = 1 + rng() % 6;
+		m[i] = random_function<truth6>(ninputs[i]);
+	}
+
+	npn_semiclass_batch(m.data(), ninputs.data(), nsamples, sc.data(), npn.data());
+	for (int i = 0; i < nsamples; i++) {
+		NPN scalar_npn;
+		CHECK(sc[i] == npn_semiclass(m[i], ninputs[i], scalar_npn));
+		CHECK(npn[i].word == scalar_npn.word);
+	}
+	printf("check kind=batch functions=%d\n", nsamples);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char *name, int ninputs, uint64_t ops, double seconds)
+{
+	printf("bench name=%s k=%d ops=%llu seconds=%.4f ops_per_sec=%.4g\n", name, ninputs,
+		   (unsigned long long) ops, seconds, ops / seconds);
+}
+
+template<typename T>
+static void bench_semiclass(int ninputs, int nfunctions, int nrounds)
+{
+	std::vector<T> fs(nfunctions);
+	for (auto &f : fs)
+		f = random_function<T>(ninputs);
+
+	T acc = {};
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < nrounds; round++)
+	for (auto &f : fs) {
+		NPN npn;
+		acc ^= npn_semiclass(f, ninputs, npn);
+	}
+	double seconds = seconds_since(start);
+	keep = acc == T{};
+	report("semiclass", ninputs, (uint64_t) nfunctions * nrounds, seconds);
+}
+
+static void bench_batch(int ninputs, int nfunctions, int nrounds)
+{
+	std::vector<truth6> fs(nfunctions), sc(nfunctions);
+	std::vector<int> nins(nfunctions, ninputs);
+	std::vector<NPN> npn(nfunctions);
+	for (auto &f : fs)
+		f = random_function<truth6>(ninputs);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int round = 0; round < nrounds; round++)
+		npn_semiclass_batch(fs.data(), nins.data(), nfunctions, sc.data(), npn.data());
+	double seconds = seconds_since(start);
+	report("semiclass_batch", ninputs, (uint64_t) nfunctions * nrounds, seconds);
+}
+
+template<typename T>
+static void bench_allrepr(int ninputs, int nfunctions)
+{
+	std::vector<T> fs(nfunctions);
+	for (auto &f : fs)
+		f = random_function<T>(ninputs);
+
+	uint64_t nreprs = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (auto &f : fs) {
+		npn_semiclass_allrepr(f, ninputs, [&](T, NPN &) {
+			nreprs++;
+		});
+	}
+	double seconds = seconds_since(start);
+	report("allrepr", ninputs, nreprs, seconds);
+}
+
+int main(int argc, char const *argv[])
+{
+	bool bench = false;
+	int nsamples = 2000;
+	uint64_t seed = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-bench")) {
+			bench = true;
+		} else if (!strcmp(argv[i], "-samples") && i + 1 < argc) {
+			nsamples = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-seed") && i + 1 < argc) {
+			seed = strtoull(argv[++i], NULL, 0);
+		} else {
+			fprintf(stderr, "usage: %s [-bench] [-samples N] [-seed N]\n", argv[0]);
+			return 2;
+		}
+	}
+	rng.seed(seed);
+
+	for (int n = 1; n <= NPNExact::max_inputs; n++)
+		check_exhaustive(n);
+	check_random<truth6>(5, nsamples);
+	check_random<truth6>(6, nsamples);
+	check_random<truth8>(7, nsamples / 10);
+	check_random<truth8>(8, nsamples / 10);
+	check_batch(nsamples * 10);
+
+	if (bench) {
+		for (int n = 4; n <= 6; n++)
+			bench_semiclass<truth6>(n, 4096, 256);
+		bench_semiclass<truth8>(8, 4096, 16);
+		for (int n = 5; n <= 6; n++)
+			bench_batch(n, 4096, 256);
+		for (int n = 5; n <= 6; n++)
+			bench_allrepr<truth6>(n, 16384);
+		bench_allrepr<truth8>(8, 1024);
+	}
+
+	printf("result failures=%d\n", nfailures);
+	return nfailures ? 1 : 0;
+}
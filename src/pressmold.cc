@@ -2,7 +2,8 @@
 // pressmold -- an OpenSTA-based standard cell mapper
 //
 
-#define CUT_MAXIMUM		6
+#define CUT_MAXIMUM		8
+#define CUT_DEFAULT		6
 
 //#define SIBLING_RECORDING
 
@@ -24,17 +25,47 @@
 #include <tclreadline.h>
 
 #include <algorithm>
+#include <array>
 #include <iostream>
 #include <fstream>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <barrier>
+#include <filesystem>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <string_view>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
+#include <cerrno>
 #include <cassert>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "npn.h"
 
+// FNV-1a, for fingerprinting the network and the target index
+struct Fingerprint {
+	uint64_t value = 0xcbf29ce484222325;
+
+	void add(const void *data, size_t len)
+	{
+		const unsigned char *p = (const unsigned char *) data;
+		for (size_t i = 0; i < len; i++)
+			value = (value ^ p[i]) * 0x100000001b3;
+	}
+
+	template<typename T>
+	void add(const T &v)	{ add(&v, sizeof(v)); }
+};
+
 struct TargetIndex {
 	struct {
 		sta::LibertyCell *cell;
@@ -49,91 +80,112 @@ struct TargetIndex {
 		NPN map;
 	};
 
-	std::map<std::pair<truth6, int>, std::vector<Target>> classes;
-} target_index;
+	struct Class {
+		truth8 semiclass; // up to six inputs in the lowest word
+		int ninputs;
+		std::vector<Target> targets;
+	};
 
-using Target = TargetIndex::Target;
+	// Indexed by the class id, which is what the matches refer to
+	std::vector<Class> classes;
+	std::map<std::pair<truth6, int>, int> class_ids;
+	std::map<std::pair<truth8, int>, int> wide_class_ids;
 
-struct AndNode;
-struct CutList {
-	AndNode **array;
-	int size;
+	int find_class(truth6 semiclass, int ninputs) const
+	{
+		auto it = class_ids.find(std::make_pair(semiclass, ninputs));
+		return it != class_ids.end() ? it->second : -1;
+	}
 
-	CutList(AndNode **array)
-		: array(array)
+	template<int K>
+	int find_class(const truthw<K> &semiclass, int ninputs) const
 	{
-		AndNode **p;
-		for (p = array; (p < array + CUT_MAXIMUM) && (*p != NULL); p++);
-		size = p - array;
+		if (ninputs <= 6)
+			return find_class(semiclass.w[0], ninputs);
+		auto it = wide_class_ids.find(std::make_pair(truth8(semiclass), ninputs));
+		return it != wide_class_ids.end() ? it->second : -1;
 	}
 
-	CutList(std::vector<AndNode *> &vector)
-		: array(&vector[0]), size(vector.size())
+	std::vector<Target> &class_targets(const truth8 &semiclass, int ninputs)
 	{
+		int id = find_class(semiclass, ninputs);
+		if (id == -1) {
+			id = classes.size();
+			// has to fit AndNode::Match::class_id
+			assert(id < (1 << 24));
+			if (ninputs <= 6)
+				class_ids[std::make_pair(semiclass.w[0], ninputs)] = id;
+			else
+				wide_class_ids[std::make_pair(semiclass, ninputs)] = id;
+			classes.push_back(Class{semiclass, ninputs, {}});
+		}
+		return classes[id].targets;
 	}
 
-	class iterator {
-		AndNode **p;
-	public:
-		typedef std::input_iterator_tag iterator_category;
-		typedef AndNode* value_type;
-		typedef ptrdiff_t difference_type;
-		typedef AndNode** pointer;
-		typedef AndNode*& reference;
+	uint64_t fingerprint() const
+	{
+		Fingerprint fp;
+		for (auto &cls : classes) {
+			for (int i = 0; i < (cls.ninputs > 6 ? 1 << (cls.ninputs - 6) : 1); i++)
+				fp.add(cls.semiclass.w[i]);
+			fp.add(cls.ninputs);
+			for (auto &target : cls.targets) {
+				fp.add(target.cell->name(), strlen(target.cell->name()));
+				fp.add(target.map.pack());
+			}
+		}
+		return fp.value;
+	}
+} target_index;
 
-		iterator(AndNode **p) : p(p) {}
-		iterator& operator++() { p++; return *this; }
-		bool operator==(const iterator &other) const
-			{ return p == other.p; }
-		bool operator==(AndNode **p) const
-			{ return this->p == p; }
-		int operator-(const iterator &other) const
-			{ return p - other.p; }
-		bool operator!=(const iterator &other) const { return !(*this == other); }
-		AndNode *operator*() const { return *p; }
-	};
-	iterator begin() const { return iterator(array); };
-	iterator end()   const { return iterator(array + size); };
-};
+using Target = TargetIndex::Target;
+
+struct AndNode;
 
+// Nodes refer to each other by AIGER-style variable numbers: the index
+// into the network's storage plus one, with zero standing for the constant
+// (or for no node). A NodeInput is then a literal with the negation in the
+// lowest bit.
 struct NodeInput {
 	NodeInput() {}
 	NodeInput(AndNode *node, bool negated)
 	{
 		set_node(node);
-		this->negated = negated;
+		if (negated)
+			negate();
 	}
 
-	AndNode *node = NULL;
-	bool negated = false;
+	uint32_t lit = 0;
+
+	uint32_t var() const			{ return lit >> 1; }
+	bool negated() const			{ return lit & 1; }
+	AndNode *node() const;
 
-	void negate()					{ negated ^= true; }
-	void set_node(AndNode *source)	{ negated = false; node = source; }
+	void negate()					{ lit ^= 1; }
+	void set_node(AndNode *source);
 
 	void set_const(int state)
 	{
-		set_node(NULL);
 		assert(state == 1 || state == 0);
-		if (state)
-			negate();
+		lit = state;
 	}
 
-	bool is_const() { return !node; }
-	bool eval()		{ assert(is_const()); return negated; }
+	bool is_const() const	{ return var() == 0; }
+	bool eval() const		{ assert(is_const()); return negated(); }
 	bool polarity();
 
 	bool operator<(const NodeInput &other) const
 	{
-		if (!node != !other.node)
-			return !node < !other.node;
-		return std::tie(negated, node) < std::tie(other.negated, other.node);
+		if (is_const() != other.is_const())
+			return is_const() < other.is_const();
+		return std::make_tuple(negated(), var()) < std::make_tuple(other.negated(), other.var());
 	}
 	bool operator==(const NodeInput &other) const
-			{ return std::tie(negated, node) == std::tie(other.negated, other.node); }
+			{ return lit == other.lit; }
 
 	unsigned int hash() const
 	{
-		return (uintptr_t) node + negated;
+		return lit;
 	}
 
 	std::vector<bool> truth_table(std::vector<AndNode *> &cut);
@@ -146,17 +198,53 @@ struct AndNode {
 	bool po = false;
 
 	NodeInput ins[2];
-	AndNode *sibling = NULL;
+	uint32_t sibling = 0;
 	bool polarity = false;
 	bool in_repr = false;
 
-	std::string label;
 	AndNode() {};
 
+	// Storage of the network being worked on by this thread, against
+	// which variable numbers are resolved (see Network::attach()). It
+	// has to be kept up to date by whatever moves or reallocates the
+	// node storage: Network's moves and consolidate() attach the network
+	// they leave behind, and code working on some other network in the
+	// meantime puts the previous one back with a Network::AttachGuard.
+	static inline thread_local AndNode *base = NULL;
+
+	static AndNode *at(uint32_t var)	{ return var ? base + (var - 1) : NULL; }
+	uint32_t var() const				{ return this - base + 1; }
+	AndNode *sibling_node() const		{ return at(sibling); }
+
+	// Match records are of variable length and get packed back to back,
+	// each node's list ending with a terminator word. A record is the
+	// header word, the packed NPN and the cut's leaves. The terminator
+	// is a lone header word with `size` set to 0xff (not a zero word: a
+	// zero header is a valid record with no leaves), and the cut
+	// checkpoints store the lists in this form.
 	struct Match {
-		truth6 semiclass;
+		uint32_t size : 8; // number of leaves, or `terminator`
+		uint32_t class_id : 24; // index into target_index.classes
 		NPN npn;
-		AndNode *cut[CUT_MAXIMUM];
+
+		static constexpr uint32_t terminator = 0xff;
+
+		bool end() const				{ return size == terminator; }
+		int words() const				{ return 2 + size; }
+
+		// Same as (map * npn).ic(), without composing the permutations
+		// unless the match is a wide one
+		int leaf_phases(const NPN &map) const
+		{
+			if (npn.wide())
+				return (map * npn).ic();
+			return npn_tables.permute_phase[npn.pidx()][map.ic()] ^ npn.ic();
+		}
+		uint32_t *cut()					{ return (uint32_t *) (this + 1); }
+		const uint32_t *cut() const		{ return (const uint32_t *) (this + 1); }
+		struct CutList leaves() const;
+
+		static int max_words(int max_cut)	{ return 2 + max_cut; }
 	};
 
 	// Scratch area for algorithms
@@ -164,50 +252,24 @@ struct AndNode {
 	union {
 		int idx;
 		int refs;
-		struct {
-			Match *matches;
-			struct {
-				union {
-					float farea;
-					int depth;
-				};
-				float flow_fouts;
-				float area;
-				float fuzzy_fouts;
-
-				// an invariant: if matches_valid on Network is true
-				// and this node's map_fouts is non-zero, then sel/sel_target
-				// must be valid
-				int sel;
-				Target *sel_target;
-
-				int map_fouts;
-				int save_sel;
-				Target *save_sel_target;
-				float save_area;
-				sta::Net *net;
-			} pol[2];
-		};
-		AndNode *replacement;
 	};
 
-	sta::Net *net;
+	uint32_t *matches; // records as described at Match
+	Match &match(int offset)	{ return *(Match *) (matches + offset); }
 	int fanouts;
 	int fid; // frontier index
 
 	truth6 weval;
 	void propagate_weval()	{ weval = ins[0].weval() & ins[1].weval(); }
 
-	void apply_replacements()
+	// `vars` maps the old variable numbers to the new ones
+	void renumber(const std::vector<uint32_t> &vars)
 	{
-		for (int i = 0; i < 2; i++)
-		if (ins[i].node && ins[i].node->replacement) {
-			assert(ins[i].node != ins[i].node->replacement);
-			ins[i].node = ins[i].node->replacement;
+		for (auto &in : ins) {
+			assert(in.is_const() || vars[in.var()]);
+			in.lit = 2 * vars[in.var()] + in.negated();
 		}
-
-		if (sibling && sibling->replacement)
-			sibling = sibling->replacement;
+		sibling = vars[sibling];
 	}
 
 	bool expand();
@@ -235,7 +297,7 @@ struct AndNode {
 			bool operator!=(const iterator &other) const
 				{ return !(*this == other); }
 			AndNode *operator*() const
-				{ return pos == -1 ? node->sibling : node->ins[pos].node; }
+				{ return pos == -1 ? node->sibling_node() : node->ins[pos].node(); }
 		};
 		iterator begin() const
 			{ return iterator(node, include_sibling ? -1 : 0).normalize(); };
@@ -278,22 +340,31 @@ struct AndNode {
 	}
 };
 
+AndNode *NodeInput::node() const
+{
+	return AndNode::at(var());
+}
+
+void NodeInput::set_node(AndNode *source)
+{
+	lit = source ? 2 * source->var() : 0;
+}
+
 truth6 NodeInput::weval()
 {
-	if (!node) {
-		assert(is_const());
+	if (is_const()) {
 		return eval() ? ~(truth6) 0 : 0;
 	} else {
-		return negated ? ~node->weval : node->weval;
+		return negated() ? ~node()->weval : node()->weval;
 	}
 }
 
 std::vector<bool> NodeInput::truth_table(std::vector<AndNode *> &cut)
 {
-	if (!node) {
-		return std::vector<bool>(1 << cut.size(), negated);
+	if (is_const()) {
+		return std::vector<bool>(1 << cut.size(), negated());
 	} else {
-		return node->truth_table(cut, negated);
+		return node()->truth_table(cut, negated());
 	}
 }
 
@@ -302,111 +373,763 @@ bool NodeInput::polarity()
 	if (is_const())
 		return eval();
 	else
-		return node->polarity ^ negated;
+		return node()->polarity ^ negated();
+}
+
+// A list of variables, zero-terminated unless it fills the array,
+// iterated over as nodes
+struct CutList {
+	const uint32_t *array;
+	int size;
+
+	template<size_t N>
+	CutList(const uint32_t (&array)[N])
+		: array(array)
+	{
+		const uint32_t *p;
+		for (p = array; (p < array + N) && *p; p++);
+		size = p - array;
+	}
+
+	CutList(const uint32_t *array, int size)
+		: array(array), size(size)
+	{
+	}
+
+	class iterator {
+		const uint32_t *p;
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef AndNode* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef AndNode** pointer;
+		typedef AndNode*& reference;
+
+		iterator(const uint32_t *p) : p(p) {}
+		iterator& operator++() { p++; return *this; }
+		bool operator==(const iterator &other) const
+			{ return p == other.p; }
+		int operator-(const iterator &other) const
+			{ return p - other.p; }
+		bool operator!=(const iterator &other) const { return !(*this == other); }
+		AndNode *operator*() const { return AndNode::at(*p); }
+	};
+	iterator begin() const { return iterator(array); };
+	iterator end()   const { return iterator(array + size); };
+};
+
+CutList AndNode::Match::leaves() const
+{
+	return CutList(cut(), size);
 }
 
 bool AndNode::detect_mux(AndNode* &s, AndNode* &a, AndNode* &b)
 {
-	AndNode *n1 = ins[0].node, *n2 = ins[1].node;
+	AndNode *n1 = ins[0].node(), *n2 = ins[1].node();
 	if (!n1 || !n2)
 		return false;
-	if (!n1->ins[0].node || !n1->ins[1].node)
+	if (!n1->ins[0].node() || !n1->ins[1].node())
 		return false;
-	if (!n2->ins[0].node || !n2->ins[1].node)
+	if (!n2->ins[0].node() || !n2->ins[1].node())
 		return false;
 
 	// TODO: has some rare false positives
-	if (n1->ins[0].node == n2->ins[0].node) {
-		s = n1->ins[0].node;
-		a = n1->ins[1].node;
-		b = n2->ins[1].node;
-	} else if (n1->ins[0].node == n2->ins[1].node) {
-		s = n1->ins[0].node;
-		a = n1->ins[1].node;
-		b = n2->ins[0].node;
-	} else if (n1->ins[1].node == n2->ins[0].node) {
-		s = n1->ins[1].node;
-		a = n1->ins[0].node;
-		b = n2->ins[1].node;
-	} else if (n1->ins[1].node == n2->ins[1].node) {
-		s = n1->ins[1].node;
-		a = n1->ins[0].node;
-		b = n2->ins[0].node;
+	if (n1->ins[0].node() == n2->ins[0].node()) {
+		s = n1->ins[0].node();
+		a = n1->ins[1].node();
+		b = n2->ins[1].node();
+	} else if (n1->ins[0].node() == n2->ins[1].node()) {
+		s = n1->ins[0].node();
+		a = n1->ins[1].node();
+		b = n2->ins[0].node();
+	} else if (n1->ins[1].node() == n2->ins[0].node()) {
+		s = n1->ins[1].node();
+		a = n1->ins[0].node();
+		b = n2->ins[1].node();
+	} else if (n1->ins[1].node() == n2->ins[1].node()) {
+		s = n1->ins[1].node();
+		a = n1->ins[0].node();
+		b = n2->ins[0].node();
 	} else {
 		return false;
 	}
 	return true;
 }
 
-truth6 mask6(int n) {
-	if (n == 6)
-		return ~(truth6) 0;
-	return (((truth6) 1) << (1 << n)) - 1;
-}
+// Re-expresses t1 over the superset vars2 of its variables vars1, for
+// cuts of up to K leaves. The function is spread over all K variables
+// first so that moving each variable in place, top one first, only ever
+// swaps with don't-cares. Wide tables spread a word at a time past the
+// sixth variable.
+template<int K>
+truth_t<K> recode(truth_t<K> t1, CutList vars1, CutList vars2)
+{
+	truth_t<K> t2 = t1 & truth_mask<truth_t<K>>(vars1.size);
+	if constexpr (K <= 6) {
+		for (int k = vars1.size; k < K; k++)
+			t2 |= t2 << (1 << k);
+	} else {
+		for (int k = vars1.size; k < 6; k++)
+			t2.w[0] |= t2.w[0] << (1 << k);
+		int period = vars1.size > 6 ? 1 << (vars1.size - 6) : 1;
+		for (int i = period; i < t2.nwords; i++)
+			t2.w[i] = t2.w[i - period];
+	}
 
-truth6 recode6(truth6 t1, CutList vars1, CutList vars2) {
-	truth6 t2 = 0;
-	for (int i2 = 0; i2 < 1 << vars2.size; i2++) {
-		int i1 = 0;
-		auto var2it = vars2.begin();
-		int n1 = 0;
-		for (auto var1 : vars1) {
-			while (*var2it < var1)
-				++var2it;
-			assert(var2it != vars2.end() && *var2it == var1);
-			if (i2 & 1 << (var2it - vars2.begin()))
-				i1 |= 1 << n1;
-			n1++;
-		}
-		if (t1 & (truth6) 1 << i1)
-			t2 |= (truth6) 1 << i2;
-	}
-	return t2;
+	int j = vars2.size - 1;
+	for (int n1 = vars1.size - 1; n1 >= 0; n1--) {
+		while (vars2.array[j] > vars1.array[n1])
+			j--;
+		assert(j >= n1 && vars2.array[j] == vars1.array[n1]);
+		if (j != n1)
+			t2 = swap_vars(t2, n1, j);
+	}
+	return t2 & truth_mask<truth_t<K>>(vars2.size);
 }
 
-truth6 reduce6(truth6 t1, int nvars, uint32_t &removed)
+// Drops the variables t1 doesn't depend on, reporting them in `removed`
+template<int K>
+truth_t<K> reduce(truth_t<K> t1, int nvars, uint32_t &removed)
 {
-	removed = (1 << nvars) - 1;
-
-	for (int i = 0; i < 1 << nvars; i++) {
-		for (int j = 0; j < nvars; j++) {
-			if (i & (1 << j))
-				continue;
-			if ((!!(t1 & (truth6) 1 << i)) != !!(t1 & (truth6) 1 << (i | 1 << j)))
-				removed &= ~(1 << j);
-		}
+	truth_t<K> mask = truth_mask<truth_t<K>>(nvars);
+	removed = 0;
+	for (int j = 0; j < nvars && j < K; j++) {
+		bool independent;
+		if constexpr (K <= 6)
+			independent = !((t1 ^ t1 >> (1 << j)) & ~cofactor_masks[j] & mask);
+		else
+			independent = flip_var(t1 & mask, j) == (t1 & mask);
+		if (independent)
+			removed |= 1 << j;
 	}
 
 	if (!removed)
 		return t1;
 
-	truth6 t2 = 0;
-	for (unsigned int i1 = 0, i2 = 0; i1 < (1 << nvars);
-			i1 = ((i1 | removed) + 1) & ~removed, i2++) {
-		if (t1 & (truth6) 1 << i1)
-			t2 |= (truth6) 1 << i2;
+	// move the remaining variables down into place
+	truth_t<K> t2 = t1 & mask;
+	int k = 0;
+	for (int j = 0; j < nvars && j < K; j++) {
+		if (removed & 1 << j)
+			continue;
+		if (k != j)
+			t2 = swap_vars(t2, k, j);
+		k++;
+	}
+	return t2 & truth_mask<truth_t<K>>(k);
+}
+
+struct MappedFile {
+	const char *data = NULL;
+	size_t size = 0;
+
+	MappedFile(const char *filename)
+	{
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error(std::string("Failed to open ") + filename + "\n");
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			close(fd);
+			throw std::runtime_error(std::string("Failed to stat ") + filename + "\n");
+		}
+		size = st.st_size;
+
+		if (size) {
+			void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				close(fd);
+				throw std::runtime_error(std::string("Failed to map ") + filename + "\n");
+			}
+			// the advice values are enumerated, not flags, so each
+			// needs its own call; failing either only costs speed
+			if (madvise(p, size, MADV_SEQUENTIAL) < 0
+					|| madvise(p, size, MADV_WILLNEED) < 0)
+				printf("Warning: madvise on %s failed: %s\n", filename, strerror(errno));
+			data = (const char *) p;
+		}
+		close(fd);
+	}
+
+	~MappedFile()
+	{
+		if (data)
+			munmap((void *) data, size);
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+};
+
+// Cursor over an in-memory byte buffer with the few primitives
+// the AIGER format needs
+struct ByteReader {
+	const char *p;
+	const char *end;
+	// set once a binary read ran past the end of the buffer
+	bool truncated = false;
+
+	ByteReader(const MappedFile &file)
+		: p(file.data), end(file.data + file.size) {}
+	ByteReader(const char *p, const char *end)
+		: p(p), end(end) {}
+
+	bool eof() const	{ return p >= end; }
+	int get()			{ return p < end ? (unsigned char) *p++ : EOF; }
+	int peek() const	{ return p < end ? (unsigned char) *p : EOF; }
+
+	void skip_spaces()
+	{
+		while (p < end && *p == ' ')
+			p++;
+	}
+
+	bool read_uint(int &ret)
+	{
+		skip_spaces();
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		ret = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			ret = ret * 10 + (*p++ - '0');
+		return true;
+	}
+
+	std::string_view read_token()
+	{
+		skip_spaces();
+		const char *start = p;
+		while (p < end && *p != ' ' && *p != '\n')
+			p++;
+		return std::string_view(start, p - start);
+	}
+
+	std::string_view read_line()
+	{
+		const char *start = p;
+		while (p < end && *p != '\n')
+			p++;
+		std::string_view ret(start, p - start);
+		if (p < end)
+			p++;
+		return ret;
+	}
+
+	uint32_t read_varint()
+	{
+		uint32_t ret = 0;
+		int shift = 0;
+		while (true) {
+			if (p == end) {
+				truncated = true;
+				break;
+			}
+			unsigned char c = *p++;
+			ret |= (uint32_t) (c & 0x7f) << shift;
+			shift += 7;
+			if (!(c & 0x80))
+				break;
+		}
+		return ret;
+	}
+
+	uint32_t read_be32()
+	{
+		if (end - p < 4) {
+			p = end;
+			truncated = true;
+			return 0;
+		}
+		const unsigned char *q = (const unsigned char *) p;
+		p += 4;
+		return ((uint32_t) q[0] << 24) | ((uint32_t) q[1] << 16)
+				| ((uint32_t) q[2] << 8) | (uint32_t) q[3];
+	}
+
+	void skip(size_t len)
+	{
+		p += std::min(len, (size_t) (end - p));
+	}
+};
+
+// Counterpart to ByteReader for building up files in memory
+struct ByteWriter {
+	std::string buf;
+
+	void put(char c)				{ buf.push_back(c); }
+	void put(std::string_view s)	{ buf.append(s); }
+
+	void put_uint(uint32_t v)
+	{
+		char scratch[16];
+		snprintf(scratch, sizeof(scratch), "%u", v);
+		buf.append(scratch);
+	}
+
+	void put_varint(uint32_t v)
+	{
+		while (v & ~0x7f) {
+			buf.push_back((char) ((v & 0x7f) | 0x80));
+			v >>= 7;
+		}
+		buf.push_back((char) v);
+	}
+
+	void put_be32(uint32_t v)
+	{
+		buf.push_back((char) (v >> 24));
+		buf.push_back((char) (v >> 16));
+		buf.push_back((char) (v >> 8));
+		buf.push_back((char) v);
+	}
+
+	// AIGER extension section: a tag, the length, the payload
+	void put_section(char tag, const ByteWriter &payload)
+	{
+		put(tag);
+		put_be32(payload.buf.size());
+		put(payload.buf);
+	}
+};
+
+// Bump allocator for the match records. Resetting it keeps the memory
+// mapped for the next prepare_cuts run to fill in again, release() is
+// what gives it back.
+struct MatchArena {
+	// the records are made of 32-bit words, see AndNode::Match
+	typedef uint32_t Word;
+
+	// a multiple of the 2 MiB huge page size
+	static constexpr size_t chunk_bytes = 4 << 20;
+
+	struct Chunk {
+		Word *base;
+		size_t capacity;
+	};
+	std::vector<Chunk> chunks;
+	int current = 0;
+	size_t fill = 0;
+	size_t used_before = 0; // in the chunks before the current one
+
+	// applies to chunks mapped from then on, in any network
+	static inline bool huge_pages = false;
+
+	MatchArena() {}
+	~MatchArena()	{ release(); }
+
+	MatchArena(const MatchArena&) = delete;
+	MatchArena& operator=(const MatchArena&) = delete;
+	MatchArena(MatchArena&& other)	{ *this = std::move(other); }
+	MatchArena& operator=(MatchArena&& other)
+	{
+		std::swap(chunks, other.chunks);
+		std::swap(current, other.current);
+		std::swap(fill, other.fill);
+		std::swap(used_before, other.used_before);
+		return *this;
+	}
+
+	// Returns room for at least `n` consecutive words, of which
+	// commit() then claims those actually used
+	Word *reserve(size_t n)
+	{
+		for (; current < (int) chunks.size(); current++) {
+			if (fill + n <= chunks[current].capacity)
+				return chunks[current].base + fill;
+			used_before += fill;
+			fill = 0;
+		}
+
+		chunks.push_back(map_chunk(n));
+		return chunks[current].base;
+	}
+
+	void commit(size_t n)
+	{
+		assert(fill + n <= chunks[current].capacity);
+		fill += n;
+	}
+
+	void reset()
+	{
+		current = 0;
+		fill = 0;
+		used_before = 0;
+	}
+
+	void release()
+	{
+		for (auto &chunk : chunks)
+			munmap(chunk.base, chunk.capacity * sizeof(Word));
+		chunks.clear();
+		reset();
+	}
+
+	size_t used() const
+	{
+		return (used_before + fill) * sizeof(Word);
+	}
+
+	size_t footprint() const
+	{
+		size_t sum = 0;
+		for (auto &chunk : chunks)
+			sum += chunk.capacity * sizeof(Word);
+		return sum;
+	}
+
+	Chunk map_chunk(size_t n)
+	{
+		size_t bytes = (n * sizeof(Word) + chunk_bytes - 1) / chunk_bytes * chunk_bytes;
+		void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+					   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+		if (huge_pages)
+			madvise(p, bytes, MADV_HUGEPAGE);
+		return Chunk{(Word *) p, bytes / sizeof(Word)};
+	}
+};
+
+// Hash-consing of AND nodes on their pair of inputs
+struct StrashTable {
+	struct Key {
+		NodeInput a, b;
+		bool operator==(const Key &other) const
+			{ return a == other.a && b == other.b; }
+	};
+	struct KeyHash {
+		size_t operator()(const Key &key) const
+			{ return key.a.hash() * 0x9e3779b97f4a7c15 ^ key.b.hash(); }
+	};
+	std::unordered_map<Key, AndNode *, KeyHash> table;
+
+	// If the AND of `a` and `b` reduces to a constant or to one of the
+	// inputs, sets `result` and returns true. Otherwise puts `a` and `b`
+	// into a canonical order.
+	static bool fold(NodeInput &a, NodeInput &b, NodeInput &result)
+	{
+		if (b < a)
+			std::swap(a, b);
+
+		if (b.is_const()) {
+			if (b.eval())
+				result = a;
+			else
+				result.set_const(0);
+			return true;
+		}
+
+		if (a.var() == b.var()) {
+			if (a.negated() == b.negated())
+				result = a;
+			else
+				result.set_const(0);
+			return true;
+		}
+
+		return false;
+	}
+
+	AndNode *lookup(const NodeInput &a, const NodeInput &b)
+	{
+		auto it = table.find(Key{a, b});
+		return it != table.end() ? it->second : NULL;
+	}
+
+	void insert(const NodeInput &a, const NodeInput &b, AndNode *node)
+	{
+		table.emplace(Key{a, b}, node);
 	}
+};
 
-	return t2;
+// The cut sieve: semiclasses of the cut functions worth matching. They
+// live in an open-addressed table kept at most a quarter full, so most
+// lookups end on the first probe. Empty slots hold the all-ones function,
+// which isn't a semiclass (a constant canonizes to zero).
+static constexpr truth6 sieve_empty = ~(truth6) 0;
+
+static constexpr int sieve_home(truth6 function, int bits)
+{
+	return (function * 0x9e3779b97f4a7c15) >> (64 - bits);
 }
 
-uint32_t read_be32(std::istream &f) {
-	return ((uint32_t) f.get() << 24) |
-		((uint32_t) f.get() << 16) | 
-		((uint32_t) f.get() << 8) | (uint32_t) f.get();
+// Returns false if the function was present already
+static constexpr bool sieve_place(truth6 *slots, int bits, truth6 function)
+{
+	int mask = (1 << bits) - 1;
+	for (int i = sieve_home(function, bits);; i = (i + 1) & mask) {
+		if (slots[i] == function)
+			return false;
+		if (slots[i] == sieve_empty) {
+			slots[i] = function;
+			return true;
+		}
+	}
 }
 
-bool sieve_recording = 0;
-std::set<truth6> sieve = {
+static constexpr truth6 builtin_sieve[] = {
 #include "sieve.inc"
 };
+static_assert(std::is_sorted(std::begin(builtin_sieve), std::end(builtin_sieve)));
+
+static constexpr int sieve_bits(size_t size)
+{
+	return std::max((int) std::bit_width(size * 4 - 1), 4);
+}
+
+// The table for the built-in sieve is laid out at compile time
+static constexpr int builtin_sieve_bits = sieve_bits(std::size(builtin_sieve));
+static constexpr auto builtin_sieve_table = [] {
+	std::array<truth6, 1 << builtin_sieve_bits> slots;
+	slots.fill(sieve_empty);
+	for (auto function : builtin_sieve)
+		sieve_place(slots.data(), builtin_sieve_bits, function);
+	return slots;
+}();
+
+struct Sieve {
+	std::vector<truth6> slots;
+	int bits;
+	size_t size;
+
+	Sieve()
+		: slots(builtin_sieve_table.begin(), builtin_sieve_table.end()),
+		  bits(builtin_sieve_bits), size(std::size(builtin_sieve))
+	{
+	}
+
+	bool count(truth6 function) const
+	{
+		int mask = (1 << bits) - 1;
+		for (int i = sieve_home(function, bits);; i = (i + 1) & mask) {
+			if (slots[i] == function)
+				return true;
+			if (slots[i] == sieve_empty)
+				return false;
+		}
+	}
+
+	void insert(truth6 function)
+	{
+		assert(function != sieve_empty);
+		if (sieve_bits(size + 1) > bits) {
+			std::vector<truth6> old;
+			old.swap(slots);
+			bits = sieve_bits(size + 1);
+			slots.assign(1 << bits, sieve_empty);
+			for (auto f : old)
+				if (f != sieve_empty)
+					sieve_place(slots.data(), bits, f);
+		}
+		size += sieve_place(slots.data(), bits, function);
+	}
+
+	void clear()
+	{
+		bits = sieve_bits(1);
+		slots.assign(1 << bits, sieve_empty);
+		size = 0;
+	}
+
+	std::vector<truth6> sorted() const
+	{
+		std::vector<truth6> ret;
+		for (auto f : slots)
+			if (f != sieve_empty)
+				ret.push_back(f);
+		std::sort(ret.begin(), ret.end());
+		return ret;
+	}
+
+	// Adds the functions listed in a file in the format of the dump (and of
+	// sieve.inc): hex numbers separated by commas or whitespace, with '#'
+	// or '//' starting a comment
+	void load(const char *filename)
+	{
+		std::ifstream f(filename);
+		if (!f.is_open())
+			throw std::runtime_error(std::string("Failed to open ") + filename + "\n");
+
+		std::string line;
+		for (int lineno = 1; std::getline(f, line); lineno++) {
+			const char *p = line.c_str();
+			while (*(p += strspn(p, " \t\r,")) && *p != '#' && strncmp(p, "//", 2)) {
+				char *end;
+				truth6 function = strtoull(p, &end, 16);
+				if (end == p || function == sieve_empty)
+					throw std::runtime_error(std::string(filename) + ":" + std::to_string(lineno)
+											 + ": Bad sieve entry");
+				insert(function);
+				p = end;
+			}
+		}
+	}
+};
+
+bool sieve_recording = 0;
+Sieve sieve;
+
+// Functions found inside the cones of matched cuts, tallied by the cut
+// enumerator with the sieve recording on. These are what a sieve needs
+// to let through for the matches to be found.
+struct SieveRecording {
+	// occurrences by function and number of inputs
+	std::map<std::pair<truth6, int>, uint64_t> functions;
+
+	void add(truth6 function, int nvars)
+	{
+		functions[{function, nvars}]++;
+	}
+
+	void merge(const SieveRecording &other)
+	{
+		for (auto [key, count] : other.functions)
+			functions[key] += count;
+	}
+
+	struct Class {
+		uint64_t count = 0;
+		std::vector<truth6> reprs;
+	};
+
+	// The recorded classes, the most frequent first
+	std::vector<Class> ranked() const
+	{
+		std::map<truth6, Class> classes; // by the smallest representative
+		for (auto [key, count] : functions) {
+			std::vector<truth6> reprs;
+			npn_semiclass_allrepr(key.first, key.second, [&](truth6 repr, NPN &) {
+				reprs.push_back(repr);
+			});
+			std::sort(reprs.begin(), reprs.end());
+			reprs.erase(std::unique(reprs.begin(), reprs.end()), reprs.end());
+
+			auto &cls = classes[reprs.front()];
+			if (cls.reprs.empty())
+				cls.reprs = std::move(reprs);
+			cls.count += count;
+		}
+
+		std::vector<Class> ret;
+		for (auto &[key, cls] : classes)
+			ret.push_back(std::move(cls));
+		std::stable_sort(ret.begin(), ret.end(), [](const Class &a, const Class &b) {
+			return a.count > b.count;
+		});
+		return ret;
+	}
+
+	// Writes out as many of the most frequent classes as it takes to cover
+	// `coverage` of the occurrences, in the format of sieve.inc: the
+	// representatives in ascending order, each followed by the rank of
+	// its class and the class's occurrences in a comment
+	void write(std::ostream &f, double coverage) const
+	{
+		uint64_t total = 0;
+		for (auto [key, count] : functions)
+			total += count;
+
+		auto classes = ranked();
+		uint64_t covered = 0;
+		size_t nclasses = 0;
+		while (nclasses < classes.size() && covered < coverage * total)
+			covered += classes[nclasses++].count;
+
+		char line[128];
+		snprintf(line, sizeof(line), "// %zu of %zu classes, %.2f %% of %llu occurrences\n",
+				 nclasses, classes.size(), total ? covered * 100.0 / total : 0.0,
+				 (unsigned long long) total);
+		f << line;
+
+		// a function can represent classes tallied at different numbers
+		// of inputs, it's listed under the higher ranked one
+		std::vector<std::pair<truth6, size_t>> entries;
+		for (size_t i = 0; i < nclasses; i++)
+			for (auto repr : classes[i].reprs)
+				entries.push_back({repr, i});
+		std::sort(entries.begin(), entries.end());
+		entries.erase(std::unique(entries.begin(), entries.end(), [](auto &a, auto &b) {
+			return a.first == b.first;
+		}), entries.end());
+
+		for (auto [repr, i] : entries) {
+			snprintf(line, sizeof(line), "0x%016llx, // class %zu, %llu occurrences\n",
+					 (unsigned long long) repr, i + 1, (unsigned long long) classes[i].count);
+			f << line;
+		}
+
+		printf("Kept %zu of %zu classes (%zu representatives) covering %.2f %% of %llu occurrences\n",
+			   nclasses, classes.size(), entries.size(), total ? covered * 100.0 / total : 0.0,
+			   (unsigned long long) total);
+	}
+};
 
 struct Network {
 	std::string name;
 	std::vector<AndNode> node_storage;
-	std::vector<std::unique_ptr<AndNode::Match[]>> match_storage;
+	MatchArena match_arena;
+	// for the extra threads of a parallel prepare_cuts
+	std::vector<MatchArena> worker_arenas;
 	bool matches_valid = false;
 
+	// Labels of PIs and POs, by node index. They point into the file
+	// the network was read from (or into made_up_labels) and are without
+	// the escaping backslash.
+	std::vector<std::string_view> labels;
+	std::unique_ptr<MappedFile> source;
+	std::vector<char> made_up_labels;
+
+	// Mapping state, two entries per node (one per polarity) by node
+	// index. It's kept apart from the nodes so that the mapping rounds
+	// only stream through what they use.
+	struct Polarity {
+		union {
+			float farea;
+			int depth;
+		};
+		float flow_fouts;
+		float area;
+		float fuzzy_fouts;
+
+		// an invariant: if matches_valid is true and map_fouts is
+		// non-zero, then sel/sel_target must be valid
+		int sel;
+		int map_fouts;
+		Target *sel_target;
+	};
+	std::vector<Polarity> polarities;
+
+	// Selections saved by save() for stitch() to pick from
+	struct Snapshot {
+		int sel;
+		float area;
+		Target *sel_target;
+	};
+	std::vector<Snapshot> snapshots;
+
+	struct CutParams {
+		int npriority_cuts;
+		int nmatches_max;
+		int max_cut;
+		bool apply_sieve;
+		bool adaptive; // the two limits are per-node means, see assign_budgets()
+	};
+
+	// what the current matches were prepared with
+	CutParams match_params = {};
+
+	// A mapping loaded along with the network, see restore_mapping()
+	struct SavedSelection {
+		int node;
+		bool C;
+		uint32_t cut[CUT_MAXIMUM]; // variables, zero terminated
+		std::string_view cell;
+		uint32_t map;
+	};
+	std::vector<SavedSelection> saved_mapping;
+
 	// We want to be code-compatible with toymap in how we iterate
 	// over nodes. For that reason we have the NodeList indirection
 	// which lets us type
@@ -488,106 +1211,196 @@ struct Network {
 	Network() : nodes(node_storage) {}
 	~Network() {}
 
+	// Makes variable numbers resolve against this network's nodes,
+	// needs calling whenever the storage gets reallocated
+	void attach()
+	{
+		AndNode::base = node_storage.data();
+	}
+
+	// Attaches `net` again on leaving the scope, however it's left
+	struct AttachGuard {
+		Network &net;
+		~AttachGuard()	{ net.attach(); }
+	};
+
 	Network (const Network&) = delete;
 	Network& operator= (const Network&) = delete;
 	Network(Network&& other)
 			: nodes(node_storage) {
 		name = other.name;
 		std::swap(node_storage, other.node_storage);
-		std::swap(match_storage, other.match_storage);
+		std::swap(match_arena, other.match_arena);
+		std::swap(worker_arenas, other.worker_arenas);
 		matches_valid = other.matches_valid;
+		match_params = other.match_params;
+		std::swap(saved_mapping, other.saved_mapping);
+		std::swap(source, other.source);
+		std::swap(made_up_labels, other.made_up_labels);
+		std::swap(labels, other.labels);
+		std::swap(polarities, other.polarities);
+		std::swap(snapshots, other.snapshots);
+		attach();
 	}
 	Network& operator=(Network&& other) {
 		name = other.name;
 		std::swap(node_storage, other.node_storage);
-		std::swap(match_storage, other.match_storage);
+		std::swap(match_arena, other.match_arena);
+		std::swap(worker_arenas, other.worker_arenas);
 		matches_valid = other.matches_valid;
+		match_params = other.match_params;
+		std::swap(saved_mapping, other.saved_mapping);
+		std::swap(source, other.source);
+		std::swap(made_up_labels, other.made_up_labels);
+		std::swap(labels, other.labels);
+		std::swap(polarities, other.polarities);
+		std::swap(snapshots, other.snapshots);
+		attach();
 		return *this;
 	}
 
-	static Network read_aiger(std::ifstream &f, sta::ConcreteNetwork *stan=NULL,
-							  const char *name="top", const char *filename="")
+	// If `prepare` is given, cuts are enumerated while the AND section
+	// is being decoded, unless the file turns out to have choices
+	static Network read_aiger(std::unique_ptr<MappedFile> file, sta::ConcreteNetwork *stan=NULL,
+							  const char *name="top", const char *filename="",
+							  const CutParams *prepare=NULL, bool strash=false)
 	{
+		ByteReader f(*file);
+
+		if (prepare)
+			CutEnumeratorBase::check_params(*prepare);
+
 		assert(f.get() == 'a' && f.get() == 'i'
 			   && f.get() == 'g' && f.get() == ' ');
 
 		int M, I, L, O, A;
-		f >> M >> I >> L >> O >> A;
-		assert(!f.fail() && !f.eof());
+		bool header_ok = f.read_uint(M) && f.read_uint(I) && f.read_uint(L)
+							&& f.read_uint(O) && f.read_uint(A);
+		assert(header_ok);
 		assert(f.get() == '\n');
 		assert(L == 0); // no latches
 
 		Network ret;
 		ret.name = name;
 		ret.node_storage.resize(I + A + O);
+		ret.labels.resize(I + A + O);
+		ret.attach();
 		auto &nodes = ret.nodes;
 
 		for (int j = 0; j < I; j++)
 			nodes[j]->pi = true;
 
-		for (int j = I + A; j < I + A + O; j++) {
-			AndNode *node = nodes[j];
-			node->po = true;
-			node->ins[1].set_const(1);
+		std::unique_ptr<CutEnumeratorBase> enumerator;
+		if (prepare) {
+			enumerator = make_enumerator(ret, *prepare);
+			for (int j = 0; j < I; j++)
+				enumerator->visit(nodes[j]);
+		}
 
+		std::vector<int> po_pivots;
+		for (int j = 0; j < O; j++) {
 			int pivot;
-			f >> pivot;
+			bool pivot_ok = f.read_uint(pivot);
+			assert(pivot_ok);
 			assert(f.get() == '\n');
 			assert(pivot >= 0 && pivot <= (int) nodes.size() * 2);
-			NodeInput &in = node->ins[0];
+			po_pivots.push_back(pivot);
+		}
+
+		// With structural hashing on, AIGER variables don't correspond
+		// to node indices anymore: the AND nodes which survive get packed
+		// after the PIs and `var_map` keeps track of where each variable
+		// went.
+		std::vector<NodeInput> var_map;
+		StrashTable strash_table;
+		if (strash) {
+			var_map.resize(I + A + 1);
+			for (int j = 0; j < I; j++)
+				var_map[j + 1] = NodeInput(nodes[j], false);
+		}
+
+		auto decode = [&](int pivot) {
+			NodeInput in;
 			if (pivot < 2) {
 				in.set_const(pivot);
 			} else {
-				in.set_node(nodes[pivot / 2 - 1]);
+				if (strash)
+					in = var_map[pivot / 2];
+				else
+					in.set_node(nodes[pivot / 2 - 1]);
 				if (pivot & 1)
 					in.negate();
 			}
-		}
+			return in;
+		};
 
+		int nkept = 0;
 		for (int j = 0; j < A; j++) {
 			int pivot = 2 * (I + j) + 2;
-			AndNode *node = nodes[I + j];
+			NodeInput ins[2];
 
 			for (int p = 0; p < 2; p++) {
-				int c, delta = 0, shift = 0;
-				while ((c = f.get()) != EOF) {
-					delta |= (c & 0x7f) << shift;
-					shift += 7;
-					if (!(c & 0x80))
-						break;
-				}
-				pivot = pivot - delta;
+				pivot = pivot - (int) f.read_varint();
 				assert(pivot >= 0 && pivot <= (int) nodes.size() * 2);
-				NodeInput &in = node->ins[p];
-				if (pivot < 2) {
-					in.set_const(pivot);
-				} else {
-					in.set_node(nodes[pivot / 2 - 1]);
-					if (pivot & 1)
-						in.negate();
+				ins[p] = decode(pivot);
+			}
+
+			if (strash) {
+				NodeInput folded;
+				if (StrashTable::fold(ins[0], ins[1], folded)) {
+					var_map[I + j + 1] = folded;
+					continue;
+				}
+				if (AndNode *existing = strash_table.lookup(ins[0], ins[1])) {
+					var_map[I + j + 1] = NodeInput(existing, false);
+					continue;
 				}
 			}
+
+			AndNode *node = nodes[I + nkept++];
+			node->ins[0] = ins[0];
+			node->ins[1] = ins[1];
 			node->polarity = node->ins[0].polarity() &&
 								node->ins[1].polarity();
+
+			if (strash) {
+				strash_table.insert(ins[0], ins[1], node);
+				var_map[I + j + 1] = NodeInput(node, false);
+			}
+
+			if (enumerator)
+				enumerator->visit(node);
 		}
+		if (f.truncated)
+			throw std::runtime_error("AIGER file truncated in the AND section");
 
-		// update POs polarities once the guts were filled in
-		for (int j = I + A; j < I + A + O; j++) {
-			AndNode *node = nodes[j];
+		// POs go after the AND nodes we kept
+		int po_base = I + nkept;
+		for (int j = 0; j < O; j++) {
+			AndNode *node = nodes[po_base + j];
+			node->po = true;
+			node->ins[0] = decode(po_pivots[j]);
+			node->ins[1].set_const(1);
 			node->polarity = node->ins[0].polarity() &&
 								node->ins[1].polarity();
+
+			if (enumerator)
+				enumerator->visit(node);
 		}
+		ret.node_storage.resize(po_base + O);
+		ret.labels.resize(po_base + O);
 
 		int c;
 		while ((c = f.get()) != EOF) {
 			if (c == 'i' || c == 'o') {
-				int i; std::string s;
-				f >> i >> s;
-				assert(!f.eof() && !f.fail());
+				int i;
+				bool index_ok = f.read_uint(i);
+				std::string_view s = f.read_token();
+				assert(index_ok && !s.empty());
 				if (c == 'o')
-					i += I + A;
+					i += po_base;
 				assert(i >= 0 && i < (int) nodes.size());
-				nodes[i]->label = "\\" + s;
+				ret.labels[i] = s;
 			} else if (c == 'c') {
 				break;
 			} else if (c == '\n') {
@@ -599,59 +1412,117 @@ struct Network {
 
 		int ni = 0, no = 0;
 		for (auto node : nodes) {
-			if (node->pi && node->label.empty()) {
-				char name[30];
-				snprintf(name, sizeof(name), "\\i%04d", ni++);
-				node->label = name;
-			}
-			if (node->po && node->label.empty()) {
-				char name[30];
-				snprintf(name, sizeof(name), "\\o%04d", no++);
-				node->label = name;
-			}
+			if ((node->pi || node->po) && ret.label(node).empty())
+				ni++;
+			node->sibling = 0;
+		}
 
-			node->sibling = NULL;
+		// the made-up names have to be stable, so reserve the worst case
+		// upfront and never let the buffer reallocate
+		ret.made_up_labels.reserve(ni * 16);
+		ni = 0;
+		for (auto node : nodes) {
+			if (!ret.label(node).empty() || !(node->pi || node->po))
+				continue;
+			char name[16];
+			int len = snprintf(name, sizeof(name), "%c%04d",
+							   node->pi ? 'i' : 'o', node->pi ? ni++ : no++);
+			assert(len < (int) sizeof(name));
+			size_t start = ret.made_up_labels.size();
+			ret.made_up_labels.insert(ret.made_up_labels.end(), name, name + len);
+			ret.label(node) = std::string_view(&ret.made_up_labels[start], len);
 		}
 
 		if (ni || no)
 			printf("Made up %d input and %d output names\n", ni, no);
 
+		int ndropped_choices = 0;
+
 		while ((c = f.get()) != EOF) {
 			switch (c) {
 			case '\n':
 				goto done;
 			case 'q':
 				{
-					read_be32(f);
-					int pairnum = read_be32(f);
+					f.read_be32();
+					int pairnum = f.read_be32();
 					for (int i = 0; i < pairnum; i++) {
-						int repr = read_be32(f);
-						int sibling = read_be32(f);
+						int repr = f.read_be32();
+						int sibling = f.read_be32();
 						assert(repr >= 0 && sibling >= 0);
+						if (f.truncated)
+							throw std::runtime_error("AIGER file truncated in the choice section");
 						assert(repr - 1 < nodes.size() && sibling < repr);
-						assert(!f.eof() && !f.fail());
 						if (sibling == 0) {
 							printf("Warning: constant choice! Ignoring.\n");
 							continue;
 						}
-						nodes[repr - 1]->sibling = nodes[sibling - 1];
+						if (strash) {
+							NodeInput repr_in = var_map[repr], sibling_in = var_map[sibling];
+							if (repr_in.is_const() || sibling_in.is_const()
+									|| sibling_in.var() >= repr_in.var()
+									|| repr_in.node()->sibling) {
+								ndropped_choices++;
+								continue;
+							}
+							repr_in.node()->sibling = sibling_in.var();
+							continue;
+						}
+						nodes[repr - 1]->sibling = sibling;
 					}
 				}
 				break;
 			case 'n':
+				// TODO: we are ignoring the name because it usually
+				// contains slashes
+				f.skip(f.read_be32());
+				break;
+			case 'm':
 				{
-					uint32_t len = read_be32(f);
-					ret.name = std::string(len, '\0');
-					f.read(&ret.name[0], len);
+					uint32_t len = f.read_be32();
+					ByteReader section(f.p, f.p + std::min(len, (uint32_t) (f.end - f.p)));
+					f.skip(len);
+
+					// selections touching the merged nodes are dropped,
+					// restore_mapping() will fill in for them
+					bool valid;
+					auto translate = [&](uint32_t var) {
+						assert(var > 0 && var <= (uint32_t) (I + A));
+						if (!strash)
+							return var;
+						NodeInput in = var_map[var];
+						valid &= !in.is_const() && !in.negated();
+						return in.var();
+					};
 
-					// TODO: we are resetting the name because it usually
-					// contains slashes
-					ret.name = name;
+					int nrecords = section.read_be32();
+					for (int i = 0; i < nrecords; i++) {
+						SavedSelection sel = {};
+						valid = true;
+						sel.node = (int) translate(section.read_be32()) - 1;
+						sel.C = section.get() == 1;
+						// a missing length byte (EOF) leaves the cut empty and
+						// is caught as truncation on the next field
+						int cutlen = std::max(section.get(), 0);
+						assert(cutlen <= CUT_MAXIMUM);
+						for (int j = 0; j < cutlen; j++)
+							sel.cut[j] = translate(section.read_be32());
+						uint32_t namelen = section.read_be32();
+						assert(namelen <= (uint32_t) (section.end - section.p));
+						sel.cell = std::string_view(section.p, namelen);
+						section.skip(namelen);
+						sel.map = section.read_be32();
+						if (section.truncated)
+							throw std::runtime_error("AIGER file truncated in the mapping section");
+						if (valid)
+							ret.saved_mapping.push_back(sel);
+					}
 				}
+				break;
 			default:
 				{
-					uint32_t len = read_be32(f);
-					f.ignore(len);
+					uint32_t len = f.read_be32();
+					f.skip(len);
 					printf("section '%c' (%d): ignoring\n", c, c); // %d bytes\n", c, c, len);
 				}
 				break;
@@ -659,17 +1530,44 @@ struct Network {
 		}
 		done:
 
-		while (true) {
-			std::string scratch;
-			std::getline(f, scratch);
-			if (f.eof())
-				break;
-			assert(!f.fail());
-			printf("input file: %s\n", scratch.c_str());
+		if (strash) {
+			// merging could have given some of the choice siblings
+			// a fanout, those we need to drop
+			ret.fanouts();
+			for (auto node : ret.nodes)
+			if (node->sibling && node->sibling_node()->fanouts) {
+				node->sibling = 0;
+				ndropped_choices++;
+			}
+
+			printf("Merged %d structurally equivalent or trivial nodes\n", A - nkept);
+			if (ndropped_choices)
+				printf("Dropped %d choice pairs invalidated by the merging\n", ndropped_choices);
+		}
+
+		while (!f.eof()) {
+			std::string_view line = f.read_line();
+			printf("input file: %.*s\n", (int) line.size(), line.data());
 		}
 
+		ret.source = std::move(file);
 		ret.verify();
-		printf("Read network '%s' with %d nodes\n", ret.name.c_str(), A);
+		printf("Read network '%s' with %d nodes\n", ret.name.c_str(), nkept);
+
+		if (enumerator) {
+			bool choices = false;
+			for (auto node : ret.nodes)
+				choices |= node->sibling != 0;
+
+			if (!choices) {
+				enumerator->finish();
+			} else {
+				// the cuts we have so far don't account for the choices
+				printf("Network has choices, redoing cut enumeration\n");
+				enumerator.reset();
+				ret.prepare_cuts(*prepare);
+			}
+		}
 
 		if (stan) {
 			sta::Library *lib = stan->findLibrary("mapping");
@@ -682,7 +1580,7 @@ struct Network {
 
 			for (auto node : ret.nodes)
 			if (node->pi || node->po) {
-				std::string port_name = sta::portVerilogToSta(node->label.c_str());
+				std::string port_name = sta::portVerilogToSta(ret.verilog_label(node).c_str());
 				sta::Port *port = stan->makePort(network_cell, port_name.c_str());
 				stan->setDirection(port, node->pi ? sta::PortDirection::input()
 											: sta::PortDirection::output());
@@ -731,7 +1629,7 @@ struct Network {
 
 		for (auto node : nodes) {
 			if (node->sibling)
-				assert(!node->sibling->fanouts);
+				assert(!node->sibling_node()->fanouts);
 
 			if (node->pi)
 				assert(!node->polarity);
@@ -773,7 +1671,7 @@ struct Network {
 				first = false;
 			else 
 				f << ", ";
-			f << node->label.c_str() << " ";
+			f << verilog_label(node) << " ";
 		}
 		f << ");\n";
 		int idx = 0;
@@ -782,22 +1680,22 @@ struct Network {
 			node->idx = idx++;
 			if (node->pi) {
 				snprintf(scratch, sizeof(scratch), "  input wire %s ;\n",
-						 node->label.c_str());
+						 verilog_label(node).c_str());
 				f << scratch;
 				snprintf(scratch, sizeof(scratch), "  wire $%08d = %s ;\n",
-						 node->idx, node->label.c_str());
+						 node->idx, verilog_label(node).c_str());
 				f << scratch;
 				continue;
 			}
-			if (node->ins[0].node && node->ins[1].node) {
+			if (node->ins[0].node() && node->ins[1].node()) {
 				snprintf(scratch, sizeof(scratch), "  wire $%08d = %s$%08d && %s$%08d;\n",
-						 node->idx, node->ins[0].negated ? "!" : "", node->ins[0].node->idx,
-						 node->ins[1].negated ? "!" : "", node->ins[1].node->idx);
-			} else if (node->ins[0].node && !node->ins[1].node) {
+						 node->idx, node->ins[0].negated() ? "!" : "", node->ins[0].node()->idx,
+						 node->ins[1].negated() ? "!" : "", node->ins[1].node()->idx);
+			} else if (node->ins[0].node() && !node->ins[1].node()) {
 				assert(node->ins[1].eval());
 				snprintf(scratch, sizeof(scratch), "  wire $%08d = %s$%08d;\n",
-						 node->idx, node->ins[0].negated ? "!" : "", node->ins[0].node->idx);
-			} else if (!node->ins[0].node && !node->ins[1].node) {
+						 node->idx, node->ins[0].negated() ? "!" : "", node->ins[0].node()->idx);
+			} else if (!node->ins[0].node() && !node->ins[1].node()) {
 				snprintf(scratch, sizeof(scratch), "  wire $%08d = %d;\n",
 						 node->idx, node->ins[0].eval() && node->ins[1].eval());
 			} else {
@@ -806,22 +1704,75 @@ struct Network {
 			f << scratch;
 			if (node->po) {
 				snprintf(scratch, sizeof(scratch), "  output wire %s = $%08d;\n",
-						 node->label.c_str(), node->idx);
+						 verilog_label(node).c_str(), node->idx);
 				f << scratch;
 			}
 		}
 		f << "endmodule\n";
 	}
 
-	int consolidate()
+	// Merges AND nodes with the same pair of inputs and folds trivial
+	// ones, rewriting the fanins downstream. The merged nodes are left
+	// in place without fanouts for consolidate() to remove. Nodes taking
+	// part in choices are never merged away.
+	int strash()
+	{
+		std::vector<NodeInput> replacements(node_storage.size());
+		std::vector<bool> is_sibling(node_storage.size());
+		for (auto node : nodes) {
+			replacements[node_index(node)] = NodeInput(node, false);
+			if (node->sibling)
+				is_sibling[node->sibling - 1] = true;
+		}
+
+		StrashTable table;
+		int nmerged = 0;
+		for (auto node : nodes) {
+			if (node->pi)
+				continue;
+
+			for (auto &in : node->ins)
+			if (!in.is_const()) {
+				bool negated = in.negated();
+				in = replacements[in.var() - 1];
+				if (negated)
+					in.negate();
+			}
+
+			if (node->po || is_sibling[node_index(node)])
+				continue;
+
+			NodeInput a = node->ins[0], b = node->ins[1], folded;
+			if (StrashTable::fold(a, b, folded)) {
+				if (node->sibling)
+					continue;
+				replacements[node_index(node)] = folded;
+				nmerged++;
+			} else if (AndNode *existing = table.lookup(a, b); existing && !node->sibling) {
+				replacements[node_index(node)] = NodeInput(existing, false);
+				nmerged++;
+			} else {
+				table.insert(a, b, node);
+			}
+		}
+
+		printf("Merged %d structurally equivalent or trivial nodes\n", nmerged);
+		return nmerged;
+	}
+
+	int consolidate(bool with_strash=false)
 	{
 		// pointers within cuts are invalidated by the move
 		invalidate_matches();
+		// and so are the node indices in a saved mapping
+		saved_mapping.clear();
+
+		if (with_strash)
+			strash();
 
 		std::vector<AndNode*> used;
 
 		for (auto node : nodes) {
-			node->replacement = NULL;
 			node->refs = 0;
 
 			if (node->po) {
@@ -866,18 +1817,23 @@ struct Network {
 		}
 
 		std::vector<AndNode> new_storage;
+		std::vector<std::string_view> new_labels;
 		new_storage.resize(used.size());
+		new_labels.resize(used.size());
+		std::vector<uint32_t> new_vars(node_storage.size() + 1);
 		int pos = 0;
 		for (auto it = used.rbegin(); it != used.rend(); it++) {
 			AndNode *old = *it;
-			AndNode *new_ = &new_storage[pos++];
-			old->apply_replacements();
-			*new_ = *old;
-			old->replacement = new_;
+			new_storage[pos] = *old;
+			new_storage[pos].renumber(new_vars);
+			new_labels[pos] = label(old);
+			new_vars[old->var()] = ++pos;
 		}
 
 		int nremoved = node_storage.size() - new_storage.size();
 		new_storage.swap(node_storage);
+		new_labels.swap(labels);
+		attach();
 
 		if (nremoved)
 			printf("Removed %d unused nodes\n", nremoved);
@@ -894,17 +1850,16 @@ struct Network {
 			node->visited = false;
 		}
 
+		// the cuts of a node are read by its fanouts, and by the node
+		// it's a choice sibling of (see CutEnumerator::visit())
 		for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
-			for (auto node_repr : (*it)->fanins()) {
-				for (AndNode *node = node_repr;
-						node != NULL; node = node->sibling) {
-					assert(!node->visited);
-					if (!node->fid) {
-						if (free_indices.empty())
-							free_indices.push_back(frontier_size++);
-						node->fid = free_indices.back();
-						free_indices.pop_back();
-					}
+			for (auto node : (*it)->pointees()) {
+				assert(!node->visited);
+				if (!node->fid) {
+					if (free_indices.empty())
+						free_indices.push_back(frontier_size++);
+					node->fid = free_indices.back();
+					free_indices.pop_back();
 				}
 			}
 
@@ -918,30 +1873,102 @@ struct Network {
 		return frontier_size;
 	}
 
+	// Sorts the nodes into levels, each only reading from the levels
+	// before it, and assigns frontier indices for visiting a level at a
+	// time: a node holds its index from its level until the last level
+	// reading it is done. The first `nscratch` indices are left to the
+	// nodes nothing reads.
+	int level_frontier(int nscratch, std::vector<std::vector<AndNode *>> &levels)
+	{
+		std::vector<int> level(node_storage.size()), last_read(node_storage.size(), -1);
+		int nlevels = 0;
+
+		for (auto node : nodes) {
+			int l = 0;
+			for (auto pointee : node->pointees())
+				l = std::max(l, level[node_index(pointee)] + 1);
+
+			for (auto pointee : node->pointees()) {
+				int &last = last_read[node_index(pointee)];
+				last = std::max(last, l);
+			}
+			level[node_index(node)] = l;
+			nlevels = std::max(nlevels, l + 1);
+		}
+
+		levels.assign(nlevels, {});
+		for (auto node : nodes)
+			levels[level[node_index(node)]].push_back(node);
+
+		int frontier_size = nscratch;
+		std::vector<int> free_indices;
+		std::vector<std::vector<AndNode *>> expiring(nlevels);
+		for (int l = 0; l < nlevels; l++) {
+			for (auto node : levels[l]) {
+				int last = last_read[node_index(node)];
+				if (last == -1) {
+					node->fid = 0;
+					continue;
+				}
+				if (free_indices.empty())
+					free_indices.push_back(frontier_size++);
+				node->fid = free_indices.back();
+				free_indices.pop_back();
+				expiring[last].push_back(node);
+			}
+
+			for (auto node : expiring[l])
+				free_indices.push_back(node->fid);
+		}
+
+		printf("Frontier is %d wide at its peak over %d levels\n", frontier_size, nlevels);
+		return frontier_size;
+	}
+
 	void invalidate_matches()
 	{
 		matches_valid = false;
-		match_storage.clear();
+		match_arena.reset();
+		for (auto &arena : worker_arenas)
+			arena.reset();
 	}
 
-	static bool cut_union(AndNode *target[], int &cutlen, int max_cut, CutList in1, CutList in2)
+	size_t match_arena_used() const
 	{
-		CutList::iterator it2 = in2.begin();
+		size_t sum = match_arena.used();
+		for (auto &arena : worker_arenas)
+			sum += arena.used();
+		return sum;
+	}
+
+	size_t match_arena_footprint() const
+	{
+		size_t sum = match_arena.footprint();
+		for (auto &arena : worker_arenas)
+			sum += arena.footprint();
+		return sum;
+	}
+
+	template<int max_cut>
+	static bool cut_union(uint32_t target[], int &cutlen, CutList in1, CutList in2)
+	{
+		const uint32_t *it2 = in2.array, *end2 = in2.array + in2.size;
 
-		for (auto n1 : in1) {
-			for (; it2 != in2.end() && *it2 < n1; ++it2) {
+		for (int i = 0; i < in1.size; i++) {
+			uint32_t n1 = in1.array[i];
+			for (; it2 != end2 && *it2 < n1; ++it2) {
 				if (cutlen == max_cut)
 					return false;
 				target[cutlen++] = *it2;
 			}
-			if (it2 != in2.end() && *it2 == n1)
+			if (it2 != end2 && *it2 == n1)
 				++it2;
 			if (cutlen == max_cut)
 				return false;
 			target[cutlen++] = n1;
 		}
 
-		for (; it2 != in2.end(); ++it2) {
+		for (; it2 != end2; ++it2) {
 			if (cutlen == max_cut)
 				return false;
 			target[cutlen++] = *it2;
@@ -949,56 +1976,549 @@ struct Network {
 		return true;
 	}
 
-	void prepare_cuts(int npriority_cuts, int nmatches_max, int max_cut, bool apply_sieve)
+	// A bit per leaf, by the variable number modulo 64. A union has at
+	// least as many leaves as the OR of the signatures has bits set, so
+	// most of the oversized unions can be rejected before merging.
+	static uint64_t leaf_signature(CutList cut)
 	{
-		if (max_cut < 3 || max_cut > CUT_MAXIMUM)
-			throw std::runtime_error("Maximum cut size out of range");
+		uint64_t ret = 0;
+		for (int i = 0; i < cut.size; i++)
+			ret |= (uint64_t) 1 << (cut.array[i] & 63);
+		return ret;
+	}
 
-		if (npriority_cuts < 1 || npriority_cuts > 65536)
-			throw std::runtime_error("Priority cuts number out of range");
+	// What of the cut enumeration doesn't depend on the cut size the
+	// enumerator is instantiated for
+	struct CutEnumeratorBase {
+		virtual ~CutEnumeratorBase() {}
+		virtual void visit(AndNode *node) = 0;
+		virtual void finish() = 0;
+
+		// Where record_sieve() tallies to, if anywhere. With `sieve -record`
+		// in effect it's `recorded`, which finish() adds to the sieve.
+		SieveRecording *recording = NULL;
+		SieveRecording recorded;
+
+		static void check_params(const CutParams &params)
+		{
+			if (params.max_cut < 3 || params.max_cut > CUT_MAXIMUM)
+				throw std::runtime_error("Maximum cut size out of range");
+
+			if (params.npriority_cuts < 1 || params.npriority_cuts > 65536)
+				throw std::runtime_error("Priority cuts number out of range");
+		}
 
-		invalidate_matches();
-		int frontier_size = frontier();
+		// POs have a single match against a dummy target
+		static Target *po_target(AndNode *node)
+		{
+			assert(node->po);
+			static Target dummy[2] = {
+				{
+					.cell = NULL,
+					.map = NPN::identity(0),
+				},
+				{
+					.cell = NULL,
+					.map = NPN::identity(1),
+				}
+			};
+			return &dummy[node->ins[0].is_const() ? 0 : 1];
+		}
+	};
+
+	// Enumerates priority cuts and matches node by node. The nodes need
+	// to be visited in topological order, but the enumerator doesn't need
+	// to see the whole network upfront, which lets the AIGER reader drive
+	// it while the AND section is being decoded. Cuts and their truth
+	// tables are sized for up to K leaves.
+	template<int K>
+	struct CutEnumerator final : CutEnumeratorBase {
+		typedef truth_t<K> truth;
 
 		struct PriorityCut {
-			AndNode *cut[CUT_MAXIMUM];
-			truth6 function;
+			uint32_t cut[K];
+			truth function;
+			uint64_t signature; // see leaf_signature()
 		};
 		struct NodeCache {
 			int ps_len;
 			PriorityCut *ps;
-			AndNode *mark;
+			uint32_t mark;
 		};
-		std::unique_ptr<PriorityCut[]> pcuts(new PriorityCut[frontier_size * npriority_cuts]);
-		std::unique_ptr<NodeCache[]> cache(new NodeCache[frontier_size]);
 
-		int matches_remaining = 0;
-		size_t matches_allocated = 0;
-		AndNode::Match *matches_page = NULL;
+		Network &net;
+		int npriority_cuts, nmatches_max;
+		static constexpr int max_cut = K;
+		bool apply_sieve, adaptive;
+
+		// Most cuts and matches any one node can have
+		int cuts_capacity, matches_capacity;
+
+		// With a frontier (see frontier()) the cache slots get reused and
+		// each has room for cuts_capacity cuts. Without one, every node has
+		// its own slot and its cut list gets packed into a growing pool.
+		// The frontier slots are shared with the workers of a parallel run.
+		int frontier_size;
+		std::shared_ptr<PriorityCut[]> pcuts;
+		std::vector<std::unique_ptr<PriorityCut[]>> pool;
+		PriorityCut *pool_free = NULL;
+		int pool_remaining = 0;
+		size_t pool_allocated = 0;
+		std::shared_ptr<NodeCache[]> cache;
+
+		// The slot for the nodes with a frontier index of zero (the ones
+		// nothing reads), one for each worker
+		int scratch_slot = 0;
+
+		// where the match records of the visited nodes go
+		MatchArena &arena;
+
+		// Canonization results by cut function, shared by all nodes. An
+		// entry which can't be placed within a few probes evicts the one
+		// in its home slot.
+		struct CanonEntry {
+			truth function;
+			truth semiclass;
+			NPN npn;
+			int16_t nvars; // -1 for an empty slot
+			int class_id;
+		};
+		static constexpr int canon_cache_bits = 15;
+		static constexpr int canon_cache_probes = 4;
+		std::unique_ptr<CanonEntry[]> canon_cache;
+		uint64_t ncanon_lookups = 0, ncanon_hits = 0;
 
 		int nnodes = 0, nsatur_cuts = 0, nsatur_matches = 0;
 
 		uint64_t nmatches_sum = 0;
 		uint64_t nmatches_sum_geom = 0;
 
-		// Go over the nodes in topological order
-		for (auto node : nodes.w_indication()) {
-			if (matches_remaining < (nmatches_max + 1)) {
-				matches_remaining = nmatches_max * 128;
-				matches_allocated += matches_remaining * sizeof(AndNode::Match);
-				matches_page = new AndNode::Match[matches_remaining];
-				match_storage.emplace_back(matches_page);
+		CutEnumerator(Network &net, const CutParams &params, int frontier_size=0)
+			: net(net), npriority_cuts(params.npriority_cuts), nmatches_max(params.nmatches_max),
+			  apply_sieve(params.apply_sieve), adaptive(params.adaptive),
+			  frontier_size(frontier_size), arena(net.match_arena)
+		{
+			check_params(params);
+			assert(params.max_cut == K);
+			if (sieve_recording)
+				recording = &recorded;
+			net.invalidate_matches();
+			net.reset_polarities();
+
+			// with a frontier the whole network is there already
+			fanouts_known = frontier_size != 0;
+			if (fanouts_known)
+				net.fanouts();
+			node_costs.reset(new NodeCost[net.node_storage.size() + 1]);
+
+			if (adaptive && !fanouts_known)
+				throw std::runtime_error("Adaptive limits need the whole network upfront");
+			cuts_capacity = adaptive ? budget_ceiling(npriority_cuts) : npriority_cuts;
+			matches_capacity = adaptive ? budget_ceiling(nmatches_max) : nmatches_max;
+			if (adaptive)
+				assign_budgets();
+
+			for (auto &cls : target_index.classes) {
+				ClassCost cost{std::numeric_limits<float>::max(), 0};
+				for (auto &target : cls.targets) {
+					cost.area = std::min(cost.area, target.cell->area());
+					cost.polarities |= 1 << target.map.oc();
+				}
+				class_costs.push_back(cost);
+			}
+
+			if (frontier_size) {
+				pcuts.reset(new PriorityCut[(size_t) frontier_size * cuts_capacity]);
+				cache.reset(new NodeCache[frontier_size]);
+			} else {
+				cache.reset(new NodeCache[net.node_storage.size() + 1]);
+			}
+
+			clear_canon_cache();
+		}
+
+		// A worker for visiting nodes alongside `lead` in a parallel run.
+		// It shares the frontier and the node estimates with the lead, and
+		// has its own scratch slot and match arena.
+		CutEnumerator(const CutEnumerator &lead, MatchArena &arena, int scratch_slot)
+			: net(lead.net), npriority_cuts(lead.npriority_cuts), nmatches_max(lead.nmatches_max),
+			  apply_sieve(lead.apply_sieve), adaptive(lead.adaptive),
+			  cuts_capacity(lead.cuts_capacity), matches_capacity(lead.matches_capacity),
+			  frontier_size(lead.frontier_size), pcuts(lead.pcuts), cache(lead.cache),
+			  scratch_slot(scratch_slot), arena(arena)
+		{
+			assert(frontier_size && !lead.recording);
+			node_costs = lead.node_costs;
+			budgets = lead.budgets;
+			fanouts_known = lead.fanouts_known;
+			class_costs = lead.class_costs;
+			clear_canon_cache();
+		}
+
+		// Takes in the statistics of a worker
+		void absorb(const CutEnumerator &worker)
+		{
+			nnodes += worker.nnodes;
+			nsatur_cuts += worker.nsatur_cuts;
+			nsatur_matches += worker.nsatur_matches;
+			nmatches_sum += worker.nmatches_sum;
+			nmatches_sum_geom += worker.nmatches_sum_geom;
+			ncanon_lookups += worker.ncanon_lookups;
+			ncanon_hits += worker.ncanon_hits;
+		}
+
+		void clear_canon_cache()
+		{
+			canon_cache.reset(new CanonEntry[1 << canon_cache_bits]);
+			for (int i = 0; i < 1 << canon_cache_bits; i++)
+				canon_cache[i].nvars = -1;
+		}
+
+		static int canon_home(const truth &function, int nvars)
+		{
+			uint64_t hash;
+			if constexpr (K <= 6) {
+				hash = (function ^ nvars) * 0x9e3779b97f4a7c15;
+			} else {
+				hash = nvars;
+				for (auto word : function.w)
+					hash = (hash ^ word) * 0x9e3779b97f4a7c15;
+			}
+			return hash >> (64 - canon_cache_bits);
+		}
+
+		CanonEntry &canon_probe(int home, int i)
+		{
+			return canon_cache[(home + i) & ((1 << canon_cache_bits) - 1)];
+		}
+
+		const CanonEntry *canon_lookup(const truth &function, int nvars)
+		{
+			ncanon_lookups++;
+			int home = canon_home(function, nvars);
+			for (int i = 0; i < canon_cache_probes; i++) {
+				auto &entry = canon_probe(home, i);
+				if (entry.nvars == nvars && entry.function == function) {
+					ncanon_hits++;
+					return &entry;
+				}
+				if (entry.nvars == -1)
+					break;
+			}
+			return NULL;
+		}
+
+		void canon_insert(const CanonEntry &entry)
+		{
+			int home = canon_home(entry.function, entry.nvars);
+			CanonEntry *slot = &canon_probe(home, 0);
+			for (int i = 0; i < canon_cache_probes; i++) {
+				auto &probe = canon_probe(home, i);
+				if (probe.nvars == -1 || (probe.nvars == entry.nvars
+										  && probe.function == entry.function)) {
+					slot = &probe;
+					break;
+				}
 			}
-			node->matches = matches_page;
+			*slot = entry;
+		}
+
+		// Cuts of the node being enumerated. They are collected first so
+		// that they can be ranked and so that the ones missing from the
+		// cache can be canonized in batches.
+		struct Candidate {
+			uint32_t cut[K];
+			int cutlen;
+			uint64_t signature; // see leaf_signature()
+			float leaf_flow; // area flow of the leaves
+			float match_flow; // plus the cheapest cell, for matches
+			int depth;
+			CanonEntry canon;
+		};
+		static constexpr int candidate_batch = 64;
+		std::vector<Candidate> candidates;
+
+		// Candidates by a sort key and their index (which keeps the order
+		// deterministic), see cut_rank() and match_rank()
+		std::vector<std::pair<uint64_t, int>> cut_ranking, match_ranking;
+		std::vector<int> kept_matches, kept_cuts;
+
+		// Estimates for the nodes visited so far, by variable number: the
+		// area flow of the best match split among the fanouts, and the
+		// least depth of a cut in cells
+		struct NodeCost {
+			float flow_share;
+			int depth;
+		};
+		std::shared_ptr<NodeCost[]> node_costs;
+
+		// Whether the network was there in full upfront, with fanouts
+		// to divide the area flow by. Without them (read_aiger
+		// -prepare_cuts) the flow is not shared out, so the same limits
+		// keep other, usually worse, cuts and matches; and as the last
+		// fanout of a node isn't known either, the node caches stay
+		// allocated for the whole network.
+		bool fanouts_known;
+
+		// By class id, the area of the cheapest cell and which output
+		// polarities the cells provide (as a mask)
+		struct ClassCost {
+			float area;
+			int polarities;
+		};
+		std::vector<ClassCost> class_costs;
+
+		// With `adaptive`, the limits of each node by variable number
+		struct NodeBudget {
+			int cuts, matches;
+		};
+		std::shared_ptr<NodeBudget[]> budgets;
+
+		static int budget_ceiling(int mean)	{ return mean * 4; }
+		static int budget_floor(int mean)	{ return std::max(std::min(mean, 2), mean / 4); }
+
+		// Hands each AND node a share of the global budgets (the means
+		// times the number of nodes) by its weight: the node's fanouts
+		// and whether it's the root of a mux or xor. Ordinary nodes with
+		// a single fanout end up below the mean.
+		void assign_budgets()
+		{
+			budgets.reset(new NodeBudget[net.node_storage.size() + 1]);
+
+			std::vector<std::pair<AndNode *, float>> weights;
+			for (auto node : net.nodes) {
+				budgets[node->var()] = NodeBudget{0, 0};
+				if (node->pi || node->po)
+					continue;
+				AndNode *s, *a, *b;
+				float weight = 1 + std::log2(std::max(node->fanouts, 1));
+				if (node->detect_mux(s, a, b))
+					weight *= 2;
+				weights.emplace_back(node, weight);
+			}
+
+			auto distribute = [&](int mean, int NodeBudget::*limit) {
+				int floor = budget_floor(mean), ceiling = budget_ceiling(mean);
+				auto share = [&](float scale, float weight) {
+					return std::clamp((int) (scale * weight), floor, ceiling);
+				};
+
+				// bisect for the scale that hands out as much of the budget
+				// as there is
+				double budget = (double) mean * weights.size();
+				float lo = 0, hi = ceiling;
+				for (int i = 0; i < 32; i++) {
+					float mid = (lo + hi) / 2;
+					double sum = 0;
+					for (auto [node, weight] : weights)
+						sum += share(mid, weight);
+					(sum > budget ? hi : lo) = mid;
+				}
+				for (auto [node, weight] : weights)
+					budgets[node->var()].*limit = share(lo, weight);
+			};
+			distribute(npriority_cuts, &NodeBudget::cuts);
+			distribute(nmatches_max, &NodeBudget::matches);
+		}
+
+		void cut_cost(Candidate &cand) const
+		{
+			cand.leaf_flow = 0;
+			cand.depth = 0;
+			for (int m = 0; m < cand.cutlen; m++) {
+				auto &leaf = node_costs[cand.cut[m]];
+				cand.leaf_flow += leaf.flow_share;
+				cand.depth = std::max(cand.depth, leaf.depth + 1);
+			}
+		}
+
+		// The bits of a non-negative float order the same as its value
+		static uint64_t flow_bits(float flow)
+		{
+			return std::bit_cast<uint32_t>(flow);
+		}
+
+		// Priority cuts go by the leaf count, the flow and then the depth.
+		// With the leaf count first, a cut ranks before any cut with a
+		// superset of its leaves (which can't have less flow or depth
+		// either).
+		static uint64_t cut_rank(const Candidate &cand)
+		{
+			return (uint64_t) cand.cutlen << 60 | flow_bits(cand.leaf_flow) << 28
+					| std::min(cand.depth, (1 << 28) - 1);
+		}
+
+		// Matches go by the flow, the depth and then the leaf count
+		static uint64_t match_rank(const Candidate &cand)
+		{
+			return flow_bits(cand.match_flow) << 32 | (uint64_t) std::min(cand.depth, (1 << 28) - 1) << 4
+					| cand.cutlen;
+		}
+
+		// Whether one of the `kept` candidates has a subset of the leaves
+		bool dominated(const Candidate &cand, const std::vector<int> &kept) const
+		{
+			for (int k : kept) {
+				auto &other = candidates[k];
+				if (!(other.signature & ~cand.signature) && other.cutlen < cand.cutlen
+						&& std::includes(cand.cut, cand.cut + cand.cutlen,
+										 other.cut, other.cut + other.cutlen))
+					return true;
+			}
+			return false;
+		}
+
+		// for record_sieve()
+		std::vector<AndNode *> cone_scratch;
+
+		// Cuts produced so far for the node being visited, kept to skip
+		// duplicates. It's an open-addressed table of the leaf lists, the
+		// entries of earlier nodes have an older stamp and count as free.
+		struct SeenCut {
+			uint32_t stamp;
+			int cutlen;
+			uint32_t cut[K];
+		};
+		std::vector<SeenCut> seen_cuts = std::vector<SeenCut>(256);
+		int nseen_cuts = 0;
+		uint32_t seen_stamp = 0;
+
+		void clear_seen_cuts()
+		{
+			nseen_cuts = 0;
+			if (++seen_stamp == 0) {
+				for (auto &entry : seen_cuts)
+					entry.stamp = 0;
+				seen_stamp = 1;
+			}
+		}
+
+		SeenCut *seen_cut_probe(const uint32_t *cut, int cutlen)
+		{
+			uint64_t hash = cutlen;
+			for (int m = 0; m < cutlen; m++)
+				hash = (hash ^ cut[m]) * 0x9e3779b97f4a7c15;
+
+			size_t mask = seen_cuts.size() - 1;
+			for (size_t i = hash >> 32;; i++) {
+				SeenCut &entry = seen_cuts[i & mask];
+				if (entry.stamp != seen_stamp)
+					return &entry;
+				if (entry.cutlen == cutlen && std::equal(cut, cut + cutlen, entry.cut))
+					return &entry;
+			}
+		}
+
+		// Returns false if the cut was produced for this node already
+		bool insert_seen_cut(const uint32_t *cut, int cutlen)
+		{
+			if ((nseen_cuts + 1) * 2 > (int) seen_cuts.size()) {
+				std::vector<SeenCut> old(seen_cuts.size() * 2);
+				old.swap(seen_cuts);
+				for (auto &entry : old) {
+					if (entry.stamp == seen_stamp)
+						*seen_cut_probe(entry.cut, entry.cutlen) = entry;
+				}
+			}
+
+			SeenCut *entry = seen_cut_probe(cut, cutlen);
+			if (entry->stamp == seen_stamp)
+				return false;
+			entry->stamp = seen_stamp;
+			entry->cutlen = cutlen;
+			std::copy(cut, cut + cutlen, entry->cut);
+			nseen_cuts++;
+			return true;
+		}
+
+		void canonize_candidates(int begin, int end)
+		{
+			assert(end - begin <= candidate_batch);
+			if constexpr (K > 6) {
+				// no batched canonizer for wide tables
+				for (int k = begin; k < end; k++) {
+					auto &canon = candidates[k].canon;
+					if (auto entry = canon_lookup(canon.function, canon.nvars)) {
+						canon = *entry;
+						continue;
+					}
+					canon.semiclass = npn_semiclass(canon.function, canon.nvars, canon.npn);
+					canon.class_id = target_index.find_class(canon.semiclass, canon.nvars);
+					canon_insert(canon);
+				}
+			} else {
+				int batch_index[candidate_batch], batch_ninputs[candidate_batch];
+				truth6 batch_functions[candidate_batch], batch_semiclass[candidate_batch];
+				NPN batch_npn[candidate_batch];
+				int n = 0;
+
+				for (int k = begin; k < end; k++) {
+					auto &canon = candidates[k].canon;
+					if (auto entry = canon_lookup(canon.function, canon.nvars)) {
+						canon = *entry;
+					} else {
+						batch_index[n] = k;
+						batch_functions[n] = canon.function;
+						batch_ninputs[n++] = canon.nvars;
+					}
+				}
+
+				npn_semiclass_batch(batch_functions, batch_ninputs, n,
+									batch_semiclass, batch_npn);
+				for (int k = 0; k < n; k++) {
+					auto &canon = candidates[batch_index[k]].canon;
+					canon.semiclass = batch_semiclass[k];
+					canon.npn = batch_npn[k];
+					canon.class_id = target_index.find_class(canon.semiclass, canon.nvars);
+					canon_insert(canon);
+				}
+			}
+		}
+
+		// The sieve only knows functions of up to six inputs, wider cuts
+		// pass it
+		bool sieved_out(const CanonEntry &canon) const
+		{
+			if constexpr (K <= 6)
+				return apply_sieve && !sieve.count(canon.semiclass);
+			else
+				return apply_sieve && canon.nvars <= 6 && !sieve.count(canon.semiclass.w[0]);
+		}
+
+		PriorityCut *cut_slots(int slot)
+		{
+			if (frontier_size)
+				return &pcuts[(size_t) slot * cuts_capacity];
+
+			if (pool_remaining < cuts_capacity) {
+				pool_remaining = std::max(cuts_capacity, 16384);
+				pool_allocated += pool_remaining;
+				pool_free = new PriorityCut[pool_remaining];
+				pool.emplace_back(pool_free);
+			}
+			return pool_free;
+		}
+
+		void visit(AndNode *node) override
+		{
+			if (!frontier_size)
+				node->fid = node - &net.node_storage.front() + 1;
+
+			node->matches = arena.reserve(std::max(matches_capacity, 1)
+										* AndNode::Match::max_words(max_cut) + 1);
 
 			// Clear the cache
-			NodeCache *lcache = &cache[node->fid];
-			lcache->ps = &pcuts[node->fid * npriority_cuts];
+			int slot = node->fid ? node->fid : scratch_slot;
+			NodeCache *lcache = &cache[slot];
+			lcache->ps = cut_slots(slot);
 			lcache->ps_len = 0;
-			lcache->mark = node;
+			lcache->mark = node->var();
+
+			auto &cost = node_costs[node->var()];
+			cost = NodeCost{0, 0};
 
 			if (node->pi)
-				continue;
+				return;
 
 			if (node->po) {
 				// PO has empty cache
@@ -1007,204 +2527,443 @@ struct Network {
 				// TODO: this isn't an aiger invariant, probably
 				assert(node->ins[1].eval());
 
-				auto &match = node->matches[0];
-				node->matches[1].cut[0] = NULL;
-				node->pol[0].sel = 0;
+				auto &match = node->match(0);
+				net.pols(node)[0].sel = 0;
 
 				int cutlen = 0;
 				for (auto fanin : node->fanins())
-					match.cut[cutlen++] = fanin;
-				match.cut[cutlen++] = NULL;
-
-				if (!node->ins[0].node) {
-					match.semiclass = npn_semiclass(0, 0, match.npn);
-					static Target dummy = {
-						.cell = NULL,
-						.map = NPN::identity(0),
-					};
-					node->pol[0].sel_target = &dummy;
-				} else {
-					static Target dummy = {
-						.cell = NULL,
-						.map = NPN::identity(1),
-					};
-					node->pol[0].sel_target = &dummy;
-					match.semiclass = npn_semiclass(node->ins[0].negated ? 1 : 2, 1,
-													match.npn);
-				}
-				matches_remaining -= 2;
-				matches_page += 2;
-				continue;
+					match.cut()[cutlen++] = fanin->var();
+				match.size = cutlen;
+				// the dummy target isn't in the index
+				match.class_id = 0;
+
+				net.pols(node)[0].sel_target = po_target(node);
+				if (node->ins[0].is_const())
+					match.npn = NPN::identity(0);
+				else
+					match.npn = NPN::make(false, node->ins[0].negated(), 0, 1);
+
+				node->match(match.words()).size = AndNode::Match::terminator;
+				arena.commit(match.words() + 1);
+				return;
 			}
 
-			AndNode *n1 = node->ins[0].node, *n1_save = n1;
-			AndNode *n2 = node->ins[1].node;
+			AndNode *n1 = node->ins[0].node();
+			AndNode *n2 = node->ins[1].node();
+
+			clear_seen_cuts();
+			candidates.clear();
 
-			std::set<int> seen_cuts;
+			int cuts_limit = npriority_cuts, matches_limit = nmatches_max;
+			if (adaptive) {
+				cuts_limit = budgets[node->var()].cuts;
+				matches_limit = budgets[node->var()].matches;
+			}
 
-			// Find up to nmatches_max of matches to technology cells
-			int nmatches = 0;
+			// Find up to matches_limit of matches to technology cells
+			int nmatches = 0, nwords = 0;
 
-			bool n1_negated = node->ins[0].negated;
-			bool n2_negated = node->ins[1].negated;
+			bool n1_negated = node->ins[0].negated();
+			bool n2_negated = node->ins[1].negated();
 
-			bool n1_choicing = false, n2_choicing = false;
-		choice_switched:
-			if (sieve_recording && (n1_choicing || n2_choicing))
+			if (recording && (n1->sibling || n2->sibling))
 				throw std::runtime_error("Sieve recording unsupported in presence of choices");
 
 			assert(n1 && n2);
-			assert(cache[n1->fid].mark == n1);
-			assert(cache[n2->fid].mark == n2);
+			assert(cache[n1->fid].mark == n1->var());
+			assert(cache[n2->fid].mark == n2->var());
 
-			AndNode *t1_nodes[2] = { n1, NULL };
-			AndNode *t2_nodes[2] = { n2, NULL };
+			uint32_t t1_nodes[2] = { n1->var(), 0 };
+			uint32_t t2_nodes[2] = { n2->var(), 0 };
 			CutList t1(t1_nodes);
 			CutList t2(t2_nodes);
+			uint64_t t1_signature = leaf_signature(t1);
+			uint64_t t2_signature = leaf_signature(t2);
 
 			for (int i = -1; i < cache[n1->fid].ps_len; i++)
 			for (int j = -1; j < cache[n2->fid].ps_len; j++) {
+				// most pairs overflow the cut limit, so those get rejected
+				// first, most of them on the signatures alone
+				uint64_t n1_signature = (i == -1) ? t1_signature : cache[n1->fid].ps[i].signature;
+				uint64_t n2_signature = (j == -1) ? t2_signature : cache[n2->fid].ps[j].signature;
+				if (std::popcount(n1_signature | n2_signature) > K)
+					continue;
+
 				CutList n1_cut = ((i == -1) ? t1 : cache[n1->fid].ps[i].cut);
 				CutList n2_cut = ((j == -1) ? t2 : cache[n2->fid].ps[j].cut);
 
-				truth6 n1_function = ((i == -1) ? 2 : cache[n1->fid].ps[i].function);
-				if (n1_negated) n1_function ^= mask6(n1_cut.size);
-				truth6 n2_function = ((j == -1) ? 2 : cache[n2->fid].ps[j].function);
-				if (n2_negated) n2_function ^= mask6(n2_cut.size);
-
-				AndNode *working_cut[CUT_MAXIMUM];
+				uint32_t working_cut[K];
 				int cutlen = 0;
-				if (!cut_union(working_cut, cutlen, max_cut, n1_cut, n2_cut))
+				if (!cut_union<K>(working_cut, cutlen, n1_cut, n2_cut))
 					continue;
 
-				truth6 cut_function = recode6(n1_function, n1_cut, working_cut) &
-										recode6(n2_function, n2_cut, working_cut);
+				truth n1_function = ((i == -1) ? truth(2) : cache[n1->fid].ps[i].function);
+				if (n1_negated) n1_function ^= truth_mask<truth>(n1_cut.size);
+				truth n2_function = ((j == -1) ? truth(2) : cache[n2->fid].ps[j].function);
+				if (n2_negated) n2_function ^= truth_mask<truth>(n2_cut.size);
+
+				CutList union_cut(working_cut, cutlen);
+				truth cut_function = recode<K>(n1_function, n1_cut, union_cut) &
+										recode<K>(n2_function, n2_cut, union_cut);
 				{
 					uint32_t removal_mask;
-					cut_function = reduce6(cut_function, cutlen, removal_mask);
+					cut_function = reduce<K>(cut_function, cutlen, removal_mask);
 					int cutlen2 = 0;
 					for (int m = 0; m < cutlen; m++) {
 						if (!(removal_mask & 1 << m))
 							working_cut[cutlen2++] = working_cut[m];
 					}
 					cutlen = cutlen2;
-					if (cutlen < CUT_MAXIMUM)
-						working_cut[cutlen] = NULL;
+					if (cutlen < K)
+						working_cut[cutlen] = 0;
 				}
 
-				int hash = 0;
-				for (auto node : CutList{working_cut})
-					hash = ((hash << 5) + hash) ^ (uintptr_t) node;
-				if (seen_cuts.count(hash))
+				if (!insert_seen_cut(working_cut, cutlen))
 					continue;
-				seen_cuts.insert(hash);
-
-				NPN npn;
-				truth6 semiclass = npn_semiclass(cut_function, cutlen, npn);
-				if (target_index.classes.count(std::make_pair(semiclass, cutlen)) && nmatches < nmatches_max) {
-					auto &match = node->matches[nmatches++];
-					match.semiclass = semiclass;
-					match.npn = npn;
-					std::copy(working_cut, working_cut + CUT_MAXIMUM,
-							  match.cut);
-
-					if (sieve_recording && cutlen >= 3) {
-						std::set<AndNode *> leaves;
-						for (auto leave : CutList{working_cut})
-							leaves.insert(leave);
-						std::set<AndNode *> seen = {node};
-						std::vector<AndNode *> queue = {node};
-						while (!queue.empty()) {
-							AndNode *n = queue.back(); queue.pop_back();
-							for (auto fanin : n->fanins()) {
-								if (!leaves.count(fanin) && !seen.count(fanin)) {
-									seen.insert(fanin);
-									queue.push_back(fanin);
-								}
-							}
-						}
 
-						static truth6 cofactor_masks[6] = {
-							0xaaaaaaaaaaaaaaaa,
-							0xcccccccccccccccc,
-							0xf0f0f0f0f0f0f0f0,
-							0xff00ff00ff00ff00,
-							0xffff0000ffff0000,
-							0xffffffff00000000
-						};
+				Candidate &cand = candidates.emplace_back();
+				std::copy(working_cut, working_cut + K, cand.cut);
+				cand.cutlen = cutlen;
+				cand.signature = leaf_signature(CutList(working_cut, cutlen));
+				cut_cost(cand);
+				cand.canon.function = cut_function & truth_mask<truth>(cutlen);
+				cand.canon.nvars = cutlen;
+			}
+
+			// A node with a choice sibling takes in the sibling's cuts, and
+			// those have the cuts of the rest of the class merged in already
+			// (siblings come first in the topological order). The cut set
+			// of the representative is then the one of the whole class,
+			// which its fanouts use as is. The sibling's trivial cut goes in
+			// too, as a priority cut, so that the fanouts can have the
+			// sibling as a leaf.
+			if (AndNode *sibling = node->sibling_node()) {
+				auto &sibling_cache = cache[sibling->fid];
+				assert(sibling_cache.mark == sibling->var());
+				bool flip = node->polarity != sibling->polarity;
+
+				uint32_t trivial[K] = { sibling->var() };
+				if (insert_seen_cut(trivial, 1)) {
+					Candidate &cand = candidates.emplace_back();
+					std::copy(trivial, trivial + K, cand.cut);
+					cand.cutlen = 1;
+					cand.signature = leaf_signature(CutList(trivial, 1));
+					cut_cost(cand);
+					cand.canon.function = truth(2);
+					if (flip)
+						cand.canon.function ^= truth_mask<truth>(1);
+					cand.canon.nvars = 1;
+				}
 
-						int n = 0;
-						for (auto leave : leaves)
-							leave->weval = cofactor_masks[n++];
+				for (int i = 0; i < sibling_cache.ps_len; i++) {
+					auto &pcut = sibling_cache.ps[i];
+					CutList cut(pcut.cut);
+					if (!insert_seen_cut(cut.array, cut.size))
+						continue;
+
+					Candidate &cand = candidates.emplace_back();
+					std::copy(pcut.cut, pcut.cut + K, cand.cut);
+					cand.cutlen = cut.size;
+					cand.signature = pcut.signature;
+					cut_cost(cand);
+					cand.canon.function = pcut.function;
+					if (flip)
+						cand.canon.function ^= truth_mask<truth>(cut.size);
+					cand.canon.nvars = cut.size;
+				}
+			}
 
-						n = 0;
-						for (auto node_ : seen) {
-							if (node_ == node)
-								continue;
-							node_->propagate_weval();
-							uint32_t removal_mask;
-							truth6 snap = reduce6(node_->weval, 6, removal_mask);
-							npn_semiclass_allrepr(snap, 6 - std::popcount(removal_mask), [&](truth6 repr, NPN &npn) {
-								sieve.insert(repr);
-							});
-						}
-					}
+			int ncandidates = candidates.size();
+			assert(ncandidates);
+			for (int k = 0; k < ncandidates; k += candidate_batch)
+				canonize_candidates(k, std::min(k + candidate_batch, ncandidates));
+
+			cut_ranking.clear();
+			match_ranking.clear();
+			cost.depth = std::numeric_limits<int>::max();
+			for (int k = 0; k < ncandidates; k++) {
+				auto &cand = candidates[k];
+				cut_ranking.emplace_back(cut_rank(cand), k);
+				cost.depth = std::min(cost.depth, cand.depth);
+				// the sibling's trivial cut is only for the fanouts, as
+				// a match it'd be a buffer or an inverter on the sibling
+				bool sibling_cut = node->sibling && cand.cutlen == 1
+									&& cand.cut[0] == node->sibling;
+				if (cand.canon.class_id != -1 && !sibling_cut) {
+					cand.match_flow = cand.leaf_flow + class_costs[cand.canon.class_id].area;
+					match_ranking.emplace_back(match_rank(cand), k);
 				}
+			}
+			std::sort(cut_ranking.begin(), cut_ranking.end());
+			std::sort(match_ranking.begin(), match_ranking.end());
 
-				if (apply_sieve && !sieve.count(semiclass))
+			float flow;
+			if (!match_ranking.empty()) {
+				flow = candidates[match_ranking[0].second].match_flow;
+			} else {
+				flow = std::numeric_limits<float>::max();
+				for (auto &cand : candidates)
+					flow = std::min(flow, cand.leaf_flow);
+			}
+			cost.flow_share = flow / (fanouts_known ? std::max(node->fanouts, 1) : 1);
+
+			// File the best of the cuts as matches and priority cuts,
+			// skipping those dominated by one filed before. Between them
+			// the matches have to provide both output polarities.
+			kept_matches.clear();
+			int covered = 0;
+			for (auto [rank, k] : match_ranking) {
+				if (nmatches == matches_limit)
+					break;
+				auto &cand = candidates[k];
+				auto &canon = cand.canon;
+				int polarities = class_costs[canon.class_id].polarities;
+				if (canon.npn.oc())
+					polarities = (polarities >> 1 | polarities << 1) & 3;
+				int nmissing = std::popcount((unsigned) ~covered & 3);
+				if (!(polarities & ~covered) && (matches_limit - nmatches <= nmissing
+												 || dominated(cand, kept_matches)))
 					continue;
 
-				if (lcache->ps_len == npriority_cuts)
+				auto &match = node->match(nwords);
+				match.size = cand.cutlen;
+				match.class_id = canon.class_id;
+				match.npn = canon.npn;
+				std::copy(cand.cut, cand.cut + cand.cutlen, match.cut());
+				nwords += match.words();
+				nmatches++;
+				covered |= polarities;
+				kept_matches.push_back(k);
+
+				if (recording && cand.cutlen >= 3 && cand.cutlen <= 6)
+					record_sieve(node, CutList(cand.cut, cand.cutlen));
+			}
+
+			kept_cuts.clear();
+			for (auto [rank, k] : cut_ranking) {
+				if (lcache->ps_len == cuts_limit)
+					break;
+				auto &cand = candidates[k];
+				if (sieved_out(cand.canon) || dominated(cand, kept_cuts))
 					continue;
+
 				int slot = lcache->ps_len++;
-				std::copy(working_cut, working_cut + CUT_MAXIMUM, lcache->ps[slot].cut);
-				lcache->ps[slot].function = cut_function;
-			}
-			if (n1->sibling) {
-				n1_negated ^= n1->polarity ^ n1->sibling->polarity;
-				n1 = n1->sibling;
-				n1_choicing = true;
-				goto choice_switched;
-			} 
-			if (n2->sibling) {
-				n2_negated ^= n2->polarity ^ n2->sibling->polarity;
-				n2 = n2->sibling;
-				n1_negated ^= n1->polarity ^ n1_save->polarity;
-				n1 = n1_save;
-				n1_choicing = false;
-				n2_choicing = true;
-				goto choice_switched;
-			} 
-
-			node->matches[nmatches].cut[0] = NULL;
-			matches_remaining -= nmatches + 1;
-			matches_page += nmatches + 1;
+				std::copy(cand.cut, cand.cut + K, lcache->ps[slot].cut);
+				lcache->ps[slot].function = cand.canon.function;
+				lcache->ps[slot].signature = cand.signature;
+				kept_cuts.push_back(k);
+			}
+
+			node->match(nwords).size = AndNode::Match::terminator;
+			arena.commit(nwords + 1);
+
+			if (!frontier_size) {
+				pool_free += lcache->ps_len;
+				pool_remaining -= lcache->ps_len;
+			}
 
 			nnodes++;
-			if (nmatches == nmatches_max)
+			if (nmatches == matches_limit)
 				nsatur_matches++;
-			if (lcache->ps_len == npriority_cuts)
+			if (lcache->ps_len == cuts_limit)
 				nsatur_cuts++;
 
 			nmatches_sum += nmatches;
 			nmatches_sum_geom += (uint64_t) nmatches * nmatches;
 		}
 
-		printf("\nCut matching statistics:\n");
-		printf("  %d nodes", nnodes);
-		printf(" %4.2f MiB cut cache", ((float) frontier_size * npriority_cuts) / (1024 * 1024));
-		printf(" %4.2f MiB match cache\n", ((float) matches_allocated) / (1024 * 1024));
-		printf("  saturated %d cuts (%.1f %%),", nsatur_cuts, ((float) nsatur_cuts * 100) / nnodes);
-		printf(" %d matches (%.1f %%)\n", nsatur_matches, ((float) nsatur_matches * 100) / nnodes);
-		printf("  matches %.1f mean %.1f geom\n", (float) nmatches_sum / nnodes,
-			   sqrt((float) nmatches_sum_geom / nnodes));
-		printf("\n");
+		// Tallies the functions of the nodes inside the cone of a matched
+		// cut, in terms of the cut leaves
+		void record_sieve(AndNode *node, CutList cut)
+		{
+			// The leaves, the node and then the cone as it's discovered.
+			// The cones are small, a linear search beats a set.
+			auto &seen = cone_scratch;
+			seen.assign(cut.begin(), cut.end());
+			int nleaves = seen.size();
+			seen.push_back(node);
+			for (int i = nleaves; i < (int) seen.size(); i++) {
+				for (auto fanin : seen[i]->fanins()) {
+					if (std::find(seen.begin(), seen.end(), fanin) == seen.end())
+						seen.push_back(fanin);
+				}
+			}
 
-		// no mapping on top of the matches yet
+			for (int i = 0; i < nleaves; i++)
+				seen[i]->weval = cofactor_masks[i];
+
+			// storage order is topological
+			std::sort(seen.begin() + nleaves + 1, seen.end());
+			for (auto it = seen.begin() + nleaves + 1; it != seen.end(); it++) {
+				(*it)->propagate_weval();
+				uint32_t removal_mask;
+				truth6 snap = reduce<6>((*it)->weval, 6, removal_mask);
+				recording->add(snap, 6 - std::popcount(removal_mask));
+			}
+		}
+
+		void finish() override
+		{
+			size_t cut_cache_size = frontier_size ? (size_t) frontier_size * cuts_capacity
+											: pool_allocated;
+
+			printf("\nCut matching statistics:\n");
+			printf("  %d nodes", nnodes);
+			printf(" %4.2f MiB cut cache", ((float) cut_cache_size) / (1024 * 1024));
+			printf(" %4.2f MiB match cache", ((float) net.match_arena_used()) / (1024 * 1024));
+			printf(" (%4.2f MiB mapped)\n", ((float) net.match_arena_footprint()) / (1024 * 1024));
+			printf("  saturated %d cuts (%.1f %%),", nsatur_cuts, ((float) nsatur_cuts * 100) / nnodes);
+			printf(" %d matches (%.1f %%)\n", nsatur_matches, ((float) nsatur_matches * 100) / nnodes);
+			printf("  matches %.1f mean %.1f geom\n", (float) nmatches_sum / nnodes,
+				   sqrt((float) nmatches_sum_geom / nnodes));
+			printf("  canonization cache %.1f %% hits of %llu lookups\n",
+				   ncanon_lookups ? (float) ncanon_hits * 100 / ncanon_lookups : 0.0f,
+				   (unsigned long long) ncanon_lookups);
+			printf("\n");
+
+			if (recording == &recorded) {
+				for (auto &cls : recorded.ranked())
+				for (auto repr : cls.reprs)
+					sieve.insert(repr);
+			}
+
+			net.matches_prepared(CutParams{npriority_cuts, nmatches_max,
+										   max_cut, apply_sieve, adaptive});
+		}
+	};
+
+	// Calls `f` with the cut limit as a compile-time constant, so that the
+	// enumerator gets instantiated for each limit
+	template<typename F>
+	static auto with_max_cut(int max_cut, F &&f)
+	{
+		static_assert(CUT_MAXIMUM == 8);
+		switch (max_cut) {
+		case 3:  return f(std::integral_constant<int, 3>());
+		case 4:  return f(std::integral_constant<int, 4>());
+		case 5:  return f(std::integral_constant<int, 5>());
+		case 6:  return f(std::integral_constant<int, 6>());
+		case 7:  return f(std::integral_constant<int, 7>());
+		case 8:  return f(std::integral_constant<int, 8>());
+		default: abort();
+		}
+	}
+
+	static std::unique_ptr<CutEnumeratorBase> make_enumerator(Network &net, const CutParams &params,
+															  int frontier_size=0)
+	{
+		return with_max_cut(params.max_cut, [&](auto K) -> std::unique_ptr<CutEnumeratorBase> {
+			return std::make_unique<CutEnumerator<K>>(net, params, frontier_size);
+		});
+	}
+
+	template<int K>
+	void enumerate_cuts(const CutParams &params, int frontier_size)
+	{
+		CutEnumerator<K> enumerator(*this, params, frontier_size);
+
+		// Go over the nodes in topological order
+		for (auto node : nodes.w_indication())
+			enumerator.visit(node);
+
+		enumerator.finish();
+	}
+
+	// Visits the nodes a level at a time (see level_frontier()), the
+	// nodes of a level spread over `nthreads` threads. The cuts and
+	// matches come out the same as with enumerate_cuts().
+	template<int K>
+	void enumerate_cuts_parallel(const CutParams &params, int nthreads)
+	{
+		std::vector<std::vector<AndNode *>> levels;
+		int frontier_size = level_frontier(nthreads, levels);
+
+		CutEnumerator<K> lead(*this, params, frontier_size);
+		worker_arenas.resize(nthreads - 1);
+		std::vector<std::unique_ptr<CutEnumerator<K>>> workers;
+		for (int i = 1; i < nthreads; i++)
+			workers.push_back(std::make_unique<CutEnumerator<K>>(lead, worker_arenas[i - 1], i));
+
+		std::atomic<int> next = 0;
+		int level = 0;
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		std::barrier level_done(nthreads, [&]() noexcept {
+			next = 0;
+			level = error ? levels.size() : level + 1;
+		});
+
+		auto run = [&](CutEnumerator<K> &enumerator) {
+			while (level < (int) levels.size()) {
+				auto &level_nodes = levels[level];
+				try {
+					for (int k; (k = next++) < (int) level_nodes.size();)
+						enumerator.visit(level_nodes[k]);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error)
+						error = std::current_exception();
+					next = level_nodes.size();
+				}
+				level_done.arrive_and_wait();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (auto &worker : workers) {
+			threads.emplace_back([&, enumerator = worker.get()]() {
+				attach();
+				run(*enumerator);
+			});
+		}
+		run(lead);
+		for (auto &thread : threads)
+			thread.join();
+		if (error)
+			std::rethrow_exception(error);
+
+		for (auto &worker : workers)
+			lead.absorb(*worker);
+		lead.finish();
+	}
+
+	void prepare_cuts(const CutParams &params, int nthreads=1)
+	{
+		CutEnumeratorBase::check_params(params);
+		if (nthreads < 1)
+			nthreads = std::max(1u, std::thread::hardware_concurrency());
+		if (nthreads > 1 && sieve_recording) {
+			printf("Sieve recording is single-threaded, ignoring -threads\n");
+			nthreads = 1;
+		}
+
+		if (nthreads > 1) {
+			with_max_cut(params.max_cut, [&](auto K) {
+				enumerate_cuts_parallel<K>(params, nthreads);
+			});
+			return;
+		}
+
+		int frontier_size = frontier();
+		with_max_cut(params.max_cut, [&](auto K) {
+			enumerate_cuts<K>(params, frontier_size);
+		});
+	}
+
+	void clear_mapping()
+	{
 		for (auto node : nodes)
 		for (int C = 0; C < 2; C++) {
-			node->pol[C].map_fouts = 0;
+			pols(node)[C].map_fouts = 0;
 		}
+	}
+
+	void matches_prepared(const CutParams &params)
+	{
+		match_params = params;
+
+		// no mapping on top of the matches yet
+		clear_mapping();
 
 		if (target_index.inv_cell && target_index.tie.cell)
 			matches_valid = true;
@@ -1212,6 +2971,365 @@ struct Network {
 			printf("Missing basic inverter/tie high/tie low cells\n");
 	}
 
+	int node_index(const AndNode *node) const
+	{
+		return node - &node_storage.front();
+	}
+
+	std::string_view &label(const AndNode *node)
+	{
+		return labels[node_index(node)];
+	}
+
+	std::string verilog_label(const AndNode *node)
+	{
+		return "\\" + std::string(label(node));
+	}
+
+	Polarity *pols(const AndNode *node)
+	{
+		return &polarities[2 * node_index(node)];
+	}
+
+	Snapshot *snapshot(const AndNode *node)
+	{
+		return &snapshots[2 * node_index(node)];
+	}
+
+	// Sets up blank mapping state for the nodes, to go along with
+	// a fresh set of matches
+	void reset_polarities()
+	{
+		polarities.assign(2 * node_storage.size(), Polarity{});
+		snapshots.assign(2 * node_storage.size(), Snapshot{});
+	}
+
+	uint64_t fingerprint() const
+	{
+		Fingerprint fp;
+		fp.add(node_storage.size());
+		for (auto &node : node_storage) {
+			fp.add((uint8_t) (node.pi | node.po << 1));
+			fp.add(node.ins[0].lit);
+			fp.add(node.ins[1].lit);
+			fp.add(node.sibling);
+		}
+		return fp.value;
+	}
+
+	// The cut checkpoint is a header, an index with the position of each
+	// node's match records, and the records themselves in the form they
+	// take in the match arena (see AndNode::Match), terminators included.
+	// There are no pointers in there, so reading it back is one copy
+	// into the arena followed by a validation pass over the records.
+	struct CheckpointHeader {
+		char magic[8];
+		uint32_t byte_order;
+		uint32_t cut_maximum;
+		uint64_t network_fingerprint;
+		uint64_t targets_fingerprint;
+		uint64_t nnodes;
+		uint64_t nwords;
+		uint64_t nmatches;
+
+		// the CutParams, in fixed-width fields
+		uint32_t npriority_cuts;
+		uint32_t nmatches_max;
+		uint32_t max_cut;
+		uint32_t flags;
+
+		static constexpr uint32_t flag_sieve = 1, flag_adaptive = 2;
+	};
+	// no padding, so that the header is the same byte for byte
+	static_assert(sizeof(CheckpointHeader) == 72);
+
+	static constexpr char checkpoint_magic[8] = "PMCUTS6";
+
+	// Length of a node's match records including the terminator
+	static int match_words(AndNode *node, int &nmatches)
+	{
+		int i;
+		for (i = 0; !node->match(i).end(); i += node->match(i).words())
+			nmatches++;
+		return i + 1;
+	}
+
+	void write_cut_checkpoint(std::ostream &f)
+	{
+		ensure_matches();
+
+		std::vector<uint64_t> offsets;
+		uint64_t nwords = 0;
+		int nmatches = 0;
+		for (auto node : nodes) {
+			offsets.push_back(nwords);
+			nwords += node->pi ? 1 : match_words(node, nmatches);
+		}
+
+		CheckpointHeader header = {};
+		std::copy(checkpoint_magic, checkpoint_magic + 8, header.magic);
+		header.byte_order = 0x01020304;
+		header.cut_maximum = CUT_MAXIMUM;
+		header.network_fingerprint = fingerprint();
+		header.targets_fingerprint = target_index.fingerprint();
+		header.nnodes = node_storage.size();
+		header.nwords = nwords;
+		header.nmatches = nmatches;
+		header.npriority_cuts = match_params.npriority_cuts;
+		header.nmatches_max = match_params.nmatches_max;
+		header.max_cut = match_params.max_cut;
+		header.flags = (match_params.apply_sieve ? CheckpointHeader::flag_sieve : 0)
+				| (match_params.adaptive ? CheckpointHeader::flag_adaptive : 0);
+		f.write((const char *) &header, sizeof(header));
+		f.write((const char *) offsets.data(), offsets.size() * sizeof(uint64_t));
+
+		for (auto node : nodes) {
+			if (node->pi) {
+				AndNode::Match terminator = {};
+				terminator.size = AndNode::Match::terminator;
+				f.write((const char *) &terminator, sizeof(uint32_t));
+				continue;
+			}
+			int unused = 0;
+			f.write((const char *) node->matches,
+					match_words(node, unused) * sizeof(uint32_t));
+		}
+	}
+
+	void read_cut_checkpoint(const MappedFile &file)
+	{
+		invalidate_matches();
+
+		auto header = (const CheckpointHeader *) file.data;
+		if (file.size < sizeof(CheckpointHeader)
+				|| !std::equal(checkpoint_magic, checkpoint_magic + 8, header->magic))
+			throw std::runtime_error("Not a cut checkpoint");
+		if (header->byte_order != 0x01020304 || header->cut_maximum != CUT_MAXIMUM)
+			throw std::runtime_error("Cut checkpoint was written by an incompatible build");
+		if (header->network_fingerprint != fingerprint()
+				|| header->nnodes != node_storage.size())
+			throw std::runtime_error("Cut checkpoint doesn't match the network");
+		if (header->targets_fingerprint != target_index.fingerprint())
+			throw std::runtime_error("Cut checkpoint doesn't match the registered cells");
+
+		size_t nnodes = header->nnodes, nwords = header->nwords;
+		if (file.size != sizeof(CheckpointHeader) + nnodes * sizeof(uint64_t)
+							+ nwords * sizeof(uint32_t))
+			throw std::runtime_error("Cut checkpoint truncated");
+
+		reset_polarities();
+		auto offsets = (const uint64_t *) (header + 1);
+		auto words = (const uint32_t *) (offsets + nnodes);
+
+		uint32_t *page = match_arena.reserve(nwords);
+		match_arena.commit(nwords);
+		std::copy(words, words + nwords, page);
+
+		// Each node's records and the terminator after them have to be
+		// within the file and refer to existing nodes and classes
+		for (auto node : nodes) {
+			size_t offset = offsets[node_index(node)];
+			if (offset >= nwords)
+				throw std::runtime_error("Cut checkpoint corrupt");
+			node->matches = page + offset;
+
+			for (size_t i = 0;; i += node->match(i).words()) {
+				if (offset + i >= nwords)
+					throw std::runtime_error("Cut checkpoint corrupt");
+				auto &match = node->match(i);
+				if (match.end())
+					break;
+				if (match.size > CUT_MAXIMUM || offset + i + match.words() > nwords
+						|| (!node->po && match.class_id >= target_index.classes.size()))
+					throw std::runtime_error("Cut checkpoint corrupt");
+				for (int j = 0; j < match.size; j++) {
+					if (match.cut()[j] - 1 >= nnodes)
+						throw std::runtime_error("Cut checkpoint corrupt");
+				}
+				// the transform gets used to index the NPN tables
+				NPN npn = match.npn;
+				if (npn.word >> 29 || npn.ninputs() != match.size
+						|| npn.wide() != (match.size > 6) || npn.ic() >> npn.ninputs()
+						|| npn.pidx() >= (npn.wide() ? NPNTables::nperms8 : NPNTables::nperms))
+					throw std::runtime_error("Cut checkpoint corrupt");
+			}
+
+			if (node->po) {
+				pols(node)[0].sel = 0;
+				pols(node)[0].sel_target = CutEnumeratorBase::po_target(node);
+			}
+		}
+
+		CutParams params{(int) header->npriority_cuts, (int) header->nmatches_max,
+						 (int) header->max_cut, (header->flags & CheckpointHeader::flag_sieve) != 0,
+						 (header->flags & CheckpointHeader::flag_adaptive) != 0};
+		printf("Restored %zu matches (-cuts %d -matches %d -max_cut %d%s%s)\n",
+			   (size_t) header->nmatches, params.npriority_cuts, params.nmatches_max,
+			   params.max_cut, params.apply_sieve ? " -sieve" : "",
+			   params.adaptive ? " -adaptive" : "");
+		matches_prepared(params);
+	}
+
+	// Writes binary AIGER with the choices in a 'q' section and, if
+	// requested, the current mapping in an 'm' section. The variables
+	// are numbered with the PIs first and the AND nodes after in the
+	// storage order, which is the order in which read_aiger will place
+	// them when reading the file back.
+	void write_aiger(std::ostream &f, bool with_mapping)
+	{
+		std::vector<uint32_t> vars(node_storage.size());
+		int I = 0, A = 0, O = 0;
+		for (auto node : nodes)
+		if (node->pi)
+			vars[node_index(node)] = ++I;
+		for (auto node : nodes) {
+			if (node->po)
+				O++;
+			else if (!node->pi)
+				vars[node_index(node)] = I + ++A;
+		}
+
+		auto lit = [&](const NodeInput &in) {
+			return in.is_const() ? (uint32_t) in.negated()
+								 : 2 * vars[in.var() - 1] + in.negated();
+		};
+
+		ByteWriter w;
+		w.put("aig ");
+		w.put_uint(I + A); w.put(' ');
+		w.put_uint(I); w.put(" 0 ");
+		w.put_uint(O); w.put(' ');
+		w.put_uint(A); w.put('\n');
+
+		for (auto node : nodes)
+		if (node->po) {
+			assert(node->ins[1].is_const() && node->ins[1].eval());
+			w.put_uint(lit(node->ins[0]));
+			w.put('\n');
+		}
+
+		for (auto node : nodes) {
+			if (node->pi || node->po)
+				continue;
+			uint32_t lhs = 2 * vars[node_index(node)];
+			uint32_t rhs0 = lit(node->ins[0]), rhs1 = lit(node->ins[1]);
+			if (rhs0 < rhs1)
+				std::swap(rhs0, rhs1);
+			assert(lhs > rhs0);
+			w.put_varint(lhs - rhs0);
+			w.put_varint(rhs0 - rhs1);
+		}
+
+		int ni = 0, no = 0;
+		for (auto node : nodes) {
+			if (!node->pi && !node->po)
+				continue;
+			w.put(node->pi ? 'i' : 'o');
+			w.put_uint(node->pi ? ni++ : no++);
+			w.put(' ');
+			w.put(label(node));
+			w.put('\n');
+		}
+
+		w.put('c');
+
+		ByteWriter choices;
+		int npairs = 0;
+		for (auto node : nodes)
+		if (node->sibling) {
+			assert(vars[node->sibling - 1] < vars[node_index(node)]);
+			choices.put_be32(vars[node_index(node)]);
+			choices.put_be32(vars[node->sibling - 1]);
+			npairs++;
+		}
+		if (npairs) {
+			ByteWriter section;
+			section.put_be32(npairs);
+			section.put(choices.buf);
+			w.put_section('q', section);
+		}
+
+		if (with_mapping) {
+			ensure_matches();
+
+			ByteWriter records;
+			int nrecords = 0;
+			for (auto node : nodes)
+			for (int C = 0; C < 2; C++) {
+				if (node->pi || node->po || !pols(node)[C].map_fouts)
+					continue;
+				auto &match = node->match(pols(node)[C].sel);
+				auto target = pols(node)[C].sel_target;
+				CutList cut = match.leaves();
+				records.put_be32(vars[node_index(node)]);
+				records.put((char) C);
+				records.put((char) cut.size);
+				for (int j = 0; j < cut.size; j++)
+					records.put_be32(vars[cut.array[j] - 1]);
+				std::string_view cell_name = target->cell->name();
+				records.put_be32(cell_name.size());
+				records.put(cell_name);
+				records.put_be32(target->map.pack());
+				nrecords++;
+			}
+
+			ByteWriter section;
+			section.put_be32(nrecords);
+			section.put(records.buf);
+			w.put_section('m', section);
+		}
+
+		w.put('\n');
+		f.write(w.buf.data(), w.buf.size());
+	}
+
+	// Re-selects the mapping saved in the file the network was read
+	// from. Selections which can't be found among the current matches
+	// are left to an initial area flow round.
+	void restore_mapping()
+	{
+		ensure_matches();
+
+		if (saved_mapping.empty())
+			throw std::runtime_error("No mapping was loaded along with the network");
+
+		// start off with a complete selection in case some of the saved
+		// ones can't be found
+		clear_mapping();
+		area_flow_round(1.0f);
+
+		int nrestored = 0;
+		for (auto &saved : saved_mapping) {
+			AndNode *node = nodes[saved.node];
+			if (node->pi || node->po)
+				continue;
+
+			auto &pol = pols(node)[saved.C];
+			for (int i = 0; !node->match(i).end(); i += node->match(i).words()) {
+				auto &match = node->match(i);
+				CutList cut = match.leaves();
+				if (!std::equal(cut.array, cut.array + cut.size, saved.cut)
+						|| (cut.size < CUT_MAXIMUM && saved.cut[cut.size]))
+					continue;
+
+				for (auto &target : target_index.classes[match.class_id].targets) {
+					if (saved.cell != target.cell->name() || target.map.pack() != saved.map
+							|| (target.map * match.npn).oc() != saved.C)
+						continue;
+					pol.sel = i;
+					pol.sel_target = &target;
+					nrestored++;
+					goto next;
+				}
+			}
+		next:;
+		}
+
+		float area = walk_mapping();
+		printf("Restored %d out of %d saved selections, area %.1f\n",
+			   nrestored, (int) saved_mapping.size(), area);
+	}
+
 	void lose_choices()
 	{
 		// touching the siblings invalidates matches
@@ -1221,45 +3339,45 @@ struct Network {
 		for (auto node : nodes) {
 			if (node->sibling)
 				nsiblings++;
-			node->sibling = NULL;
+			node->sibling = 0;
 		}
 		printf("Cleared %d choice pairs\n", nsiblings);
 	}
 
-	static void deref_cut(AndNode *node, bool C)
+	void deref_cut(AndNode *node, bool C)
 	{
 		if (node->pi)
 			return;
 
 		int n = 0;
-		auto &match = node->matches[node->pol[C].sel];
-		assert(node->pol[C].sel_target);
-		NPN local_map = node->pol[C].sel_target->map * match.npn;
-		for (auto cut_node : CutList{match.cut}) {
-			bool cut_nodeC = local_map.ic[n++];
+		auto &match = node->match(pols(node)[C].sel);
+		assert(pols(node)[C].sel_target);
+		int phases = match.leaf_phases(pols(node)[C].sel_target->map);
+		for (auto cut_node : match.leaves()) {
+			bool cut_nodeC = phases >> n++ & 1;
 			assert(cut_node != node);
-			auto &map_fouts = cut_node->pol[cut_nodeC].map_fouts;
+			auto &map_fouts = pols(cut_node)[cut_nodeC].map_fouts;
 			assert(map_fouts >= 1);
 			if (!--map_fouts)
 				deref_cut(cut_node, cut_nodeC);
 		}
 	}
 
-	static float ref_cut(AndNode *node, bool C)
+	float ref_cut(AndNode *node, bool C)
 	{
 		if (node->pi)
 			return 0;
 
 		float sum = 0;
 		int n = 0;
-		auto &match = node->matches[node->pol[C].sel];
-		assert(node->pol[C].sel_target);
-		NPN local_map = node->pol[C].sel_target->map * match.npn;
-		for (auto cut_node : CutList{match.cut}) {
+		auto &match = node->match(pols(node)[C].sel);
+		assert(pols(node)[C].sel_target);
+		int phases = match.leaf_phases(pols(node)[C].sel_target->map);
+		for (auto cut_node : match.leaves()) {
 			assert(!cut_node->po);
-			bool cut_nodeC = local_map.ic[n++];
+			bool cut_nodeC = phases >> n++ & 1;
 			assert(cut_node != node);
-			auto &cut_pol = cut_node->pol[cut_nodeC];
+			auto &cut_pol = pols(cut_node)[cut_nodeC];
 			if (!cut_pol.map_fouts++) {
 				if (cut_node->pi && cut_nodeC) {
 					sum += target_index.inv_cell->area();
@@ -1285,25 +3403,25 @@ struct Network {
 
 		for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
 			AndNode *node = *it;
-			assert(node->pol[1].map_fouts == 0);
-			assert(node->pol[0].map_fouts >= 0);
-			assert(node->pol[0].map_fouts <= node->po ? 1 : 0);
+			assert(pols(node)[1].map_fouts == 0);
+			assert(pols(node)[0].map_fouts >= 0);
+			assert(pols(node)[0].map_fouts <= node->po ? 1 : 0);
 
-			if (node->pol[0].map_fouts)
+			if (pols(node)[0].map_fouts)
 				deref_cut(node, false);
-			node->pol[0].map_fouts = 0;
+			pols(node)[0].map_fouts = 0;
 		}
 
 		for (auto node : nodes)
-			assert(!node->pol[0].map_fouts && !node->pol[1].map_fouts);
+			assert(!pols(node)[0].map_fouts && !pols(node)[1].map_fouts);
 
 		float area = 0;
 
 		for (auto node : nodes)
 		if (node->po) {
-			assert(node->pol[0].map_fouts == 0);
-			assert(node->pol[1].map_fouts == 0);
-			if (!node->pol[0].map_fouts++)
+			assert(pols(node)[0].map_fouts == 0);
+			assert(pols(node)[1].map_fouts == 0);
+			if (!pols(node)[0].map_fouts++)
 				area += ref_cut(node, false);
 		}
 
@@ -1319,7 +3437,7 @@ struct Network {
 				continue;
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				if (pol.map_fouts)
 					deref_cut(node, C);
@@ -1328,14 +3446,14 @@ struct Network {
 				int best_index = -1;
 				Target *best_target = nullptr;
 
-				for (int i = 0;; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						pol.sel = i;
@@ -1373,7 +3491,7 @@ struct Network {
 				continue;
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				if (pol.map_fouts)
 					deref_cut(node, C);
@@ -1382,14 +3500,14 @@ struct Network {
 				int best_index = -1;
 				Target *best_target = nullptr;
 
-				for (int i = 0;; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						pol.sel = i;
@@ -1425,16 +3543,16 @@ struct Network {
 				continue;
 
 			if (node->pi) {
-				int fanouts = first ? node->fanouts : std::max(node->pol[1].map_fouts, 1);
-				node->pol[0].farea = 0;
-				node->pol[1].farea = target_index.inv_cell->area() / fanouts;
-				node->pol[0].depth = 0;
-				node->pol[1].depth = 1;
+				int fanouts = first ? node->fanouts : std::max(pols(node)[1].map_fouts, 1);
+				pols(node)[0].farea = 0;
+				pols(node)[1].farea = target_index.inv_cell->area() / fanouts;
+				pols(node)[0].depth = 0;
+				pols(node)[1].depth = 1;
 				continue;
 			}
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				float best_area = std::numeric_limits<float>::max();
 				int best_index = -1;
@@ -1443,23 +3561,23 @@ struct Network {
 
 				int fanouts = first ? node->fanouts : std::max(pol.map_fouts, 1);
 
-				for (int i = 0;; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int depth = 0;
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 							depth = std::max(depth, cut_pol.depth + 1);
 						}
@@ -1501,16 +3619,16 @@ struct Network {
 				continue;
 
 			if (node->pi) {
-				int fanouts = first ? node->fanouts : std::max(node->pol[1].map_fouts, 1);
-				node->pol[0].farea = 0;
-				node->pol[1].farea = target_index.inv_cell->area() / fanouts;
-				node->pol[0].depth = 0;
-				node->pol[1].depth = 1;
+				int fanouts = first ? node->fanouts : std::max(pols(node)[1].map_fouts, 1);
+				pols(node)[0].farea = 0;
+				pols(node)[1].farea = target_index.inv_cell->area() / fanouts;
+				pols(node)[0].depth = 0;
+				pols(node)[1].depth = 1;
 				continue;
 			}
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				float best_area = std::numeric_limits<float>::max();
 				int best_index = -1;
@@ -1519,23 +3637,23 @@ struct Network {
 
 				int fanouts = first ? node->fanouts : std::max(pol.map_fouts, 1);
 
-				for (int i = 0;; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int depth = 0;
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 							depth += cut_pol.depth;
 						}
@@ -1574,8 +3692,8 @@ struct Network {
 
 		for (auto node : nodes)
 		for (int C = 0; C < 2; C++) {
-			node->pol[C].flow_fouts = \
-				std::max(refs_blend * node->fanouts + (1.0f - refs_blend) * node->pol[C].map_fouts, 1.0f);
+			pols(node)[C].flow_fouts = \
+				std::max(refs_blend * node->fanouts + (1.0f - refs_blend) * pols(node)[C].map_fouts, 1.0f);
 		}
 
 		for (auto node : nodes) {
@@ -1583,34 +3701,34 @@ struct Network {
 				continue;
 
 			if (node->pi) {
-				node->pol[0].farea = 0;
-				node->pol[1].farea = target_index.inv_cell->area() / node->pol[1].flow_fouts;
+				pols(node)[0].farea = 0;
+				pols(node)[1].farea = target_index.inv_cell->area() / pols(node)[1].flow_fouts;
 				continue;
 			}
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				float best_area = std::numeric_limits<float>::max();
 				int best_index = -1;
 				Target *best_target = nullptr;
 
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 						}
 						area = std::min(area, 1e32f);
@@ -1636,7 +3754,7 @@ struct Network {
 				}
 
 				pol.area = best_area;
-				pol.farea = best_area / node->pol[C].flow_fouts;
+				pol.farea = best_area / pols(node)[C].flow_fouts;
 			}
 		}
 	}
@@ -1649,10 +3767,10 @@ struct Network {
 		for (auto node : nodes)
 		for (int C = 0; C < 2; C++) {
 			if (first)
-				node->pol[C].flow_fouts = std::max(node->pol[C].map_fouts, 1);
+				pols(node)[C].flow_fouts = std::max(pols(node)[C].map_fouts, 1);
 			else
-				node->pol[C].flow_fouts = std::max(node->pol[C].fuzzy_fouts, 1.0f);
-			node->pol[C].fuzzy_fouts = 0;
+				pols(node)[C].flow_fouts = std::max(pols(node)[C].fuzzy_fouts, 1.0f);
+			pols(node)[C].fuzzy_fouts = 0;
 		}
 
 		for (auto node : nodes) {
@@ -1660,13 +3778,13 @@ struct Network {
 				continue;
 
 			if (node->pi) {
-				node->pol[0].farea = 0;
-				node->pol[1].farea = target_index.inv_cell->area() / node->pol[1].flow_fouts;
+				pols(node)[0].farea = 0;
+				pols(node)[1].farea = target_index.inv_cell->area() / pols(node)[1].flow_fouts;
 				continue;
 			}
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				float best_area = std::numeric_limits<float>::max();
 				int best_index = -1;
@@ -1674,22 +3792,22 @@ struct Network {
 				float Z = 0.0;
 				pol.area = 0;
 
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 						}
 						area = std::min(area, 1e32f);
@@ -1706,22 +3824,22 @@ struct Network {
 					}
 				}
 
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 						}
 						area = std::min(area, 1e32f);
@@ -1741,7 +3859,7 @@ struct Network {
 					pol.sel_target = best_target;
 				}
 
-				pol.farea = pol.area / node->pol[C].flow_fouts;
+				pol.farea = pol.area / pols(node)[C].flow_fouts;
 			}
 		}
 
@@ -1750,22 +3868,22 @@ struct Network {
 
 			if (node->po) {
 				int C = 0;
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							cut_pol.fuzzy_fouts += 1.0f;
 						}
 					}
@@ -1777,29 +3895,29 @@ struct Network {
 				continue;
 
 			for (int C = 0; C < 2; C++) {
-				auto &pol = node->pol[C];
+				auto &pol = pols(node)[C];
 
 				float best_area = std::numeric_limits<float>::max();
 				int best_index = -1;
 				Target *best_target = nullptr;
 				float Z = 0.0;
 
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 						}
 						area = std::min(area, 1e32f);
@@ -1816,22 +3934,22 @@ struct Network {
 					}
 				}
 
-				for (int i = 0; true; i++) {
-					auto &match = node->matches[i];
-					if (!match.cut[0])
+				for (int i = 0;; i += node->match(i).words()) {
+					auto &match = node->match(i);
+					if (match.end())
 						break;
 
-					for (auto &target : target_index.classes.at(std::make_pair(match.semiclass, CutList{match.cut}.size))) {
+					for (auto &target : target_index.classes[match.class_id].targets) {
 						// make sure this is a valid match
-						if ((target.map * match.npn).oc != C)
+						if ((target.map * match.npn).oc() != C)
 							continue;
 
 						NPN local_map = target.map * match.npn;
 						float area = target.cell->area();
 						int n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							area += cut_pol.farea;
 						}
 						area = std::min(area, 1e32f);
@@ -1840,9 +3958,9 @@ struct Network {
 						assert(p >= 0.0f && p <= 1.0f);
 
 						n = 0;
-						for (auto cut_node : CutList{match.cut}) {
-							bool cut_nodeC = local_map.ic[n++];
-							auto &cut_pol = cut_node->pol[cut_nodeC];
+						for (auto cut_node : match.leaves()) {
+							bool cut_nodeC = local_map.ic(n++);
+							auto &cut_pol = pols(cut_node)[cut_nodeC];
 							cut_pol.fuzzy_fouts += p;
 						}
 					}
@@ -1858,9 +3976,9 @@ struct Network {
 		// TODO: sel validity
 		for (auto node : nodes)
 		for (int C = 0; C < 2; C++) {
-			node->pol[C].save_sel = node->pol[C].sel;
-			node->pol[C].save_sel_target = node->pol[C].sel_target;
-			node->pol[C].save_area = node->pol[C].area;
+			snapshot(node)[C].sel = pols(node)[C].sel;
+			snapshot(node)[C].sel_target = pols(node)[C].sel_target;
+			snapshot(node)[C].area = pols(node)[C].area;
 		}
 	}
 
@@ -1874,12 +3992,12 @@ struct Network {
 			if (node->pi || node->po)
 				continue;
 
-			if (node->pol[C].save_area < node->pol[C].area) {
-				if (node->pol[C].map_fouts)
+			if (snapshot(node)[C].area < pols(node)[C].area) {
+				if (pols(node)[C].map_fouts)
 					deref_cut(node, C);
-				node->pol[C].sel = node->pol[C].save_sel;
-				node->pol[C].sel_target = node->pol[C].save_sel_target;
-				if (node->pol[C].map_fouts)
+				pols(node)[C].sel = snapshot(node)[C].sel;
+				pols(node)[C].sel_target = snapshot(node)[C].sel_target;
+				if (pols(node)[C].map_fouts)
 					ref_cut(node, C);
 			}
 		}
@@ -1901,31 +4019,42 @@ struct Network {
 		stan->connect(hilo_cell, target_index.tie.lo, zero);
 		stan->connect(hilo_cell, target_index.tie.hi, one);
 
+		// nets on the ports, and the nets carrying each node's
+		// polarities, by node index
+		std::vector<sta::Net *> port_nets(nodes.size());
+		std::vector<sta::Net *> pol_nets(2 * nodes.size());
+		auto port_net = [&](AndNode *node) -> sta::Net *& {
+			return port_nets[node_index(node)];
+		};
+		auto pol_net = [&](AndNode *node, bool C) -> sta::Net *& {
+			return pol_nets[2 * node_index(node) + C];
+		};
+
 		// TODO: enforce ports split per-bit
 		int autoidx = 0;
 		char buf[128];
 		for (auto node : nodes)
 		if (node->pi || node->po) {
-			std::string port_name = sta::portVerilogToSta(node->label.c_str());
+			std::string port_name = sta::portVerilogToSta(verilog_label(node).c_str());
 			sta::Port *port = stan->findPort(top_cell, port_name.c_str());
 			assert(!stan->findPin(top, port));
-			std::string net_name = sta::netVerilogToSta(node->label.c_str());
-			node->net = stan->makeNet(net_name.c_str(), top);
+			std::string net_name = sta::netVerilogToSta(verilog_label(node).c_str());
+			port_net(node) = stan->makeNet(net_name.c_str(), top);
 			sta::Pin *pin = stan->makePin(top, port, NULL);
-			stan->makeTerm(pin, node->net);
+			stan->makeTerm(pin, port_net(node));
 
 			if (node->pi) {
-				node->pol[0].net = node->net;
+				pol_net(node, 0) = port_net(node);
 				snprintf(buf, sizeof(buf), "_%08d_", autoidx++);
-				node->pol[1].net = stan->makeNet(buf, top);
+				pol_net(node, 1) = stan->makeNet(buf, top);
 
 				snprintf(buf, sizeof(buf), "_%08d_", autoidx++);
 				sta::Instance *inv = stan->makeInstance(target_index.inv_cell, buf, top);
 				sta::LibertyPort *in, *out;
 				target_index.inv_cell->bufferPorts(in, out);
 				assert(in && out);
-				stan->connect(inv, in, node->net);
-				stan->connect(inv, out, node->pol[1].net);
+				stan->connect(inv, in, port_net(node));
+				stan->connect(inv, out, pol_net(node, 1));
 			}
 		}
 
@@ -1933,11 +4062,11 @@ struct Network {
 
 		for (auto node : nodes)
 		for (int C = 0; C < 2; C++) {
-			if (!node->pol[C].map_fouts || node->pi || node->po)
+			if (!pols(node)[C].map_fouts || node->pi || node->po)
 				continue;
 
-			auto &match = node->matches[node->pol[C].sel];
-			auto target = node->pol[C].sel_target;
+			auto &match = node->match(pols(node)[C].sel);
+			auto target = pols(node)[C].sel_target;
 			NPN local_map = target->map * match.npn;
 			sta::LibertyCell *cell = target->cell;
 			assert(cell);
@@ -1961,33 +4090,34 @@ struct Network {
 			assert(outport);
 			assert(local_map.ninputs() == (int) inports.size());
 			int cutidx = 0;
-			for (auto cut_node : CutList{match.cut}) {
-				assert(cut_node->pol[local_map.ic[cutidx]].net);
-				stan->connect(gate, inports[local_map.p[cutidx]], cut_node->pol[local_map.ic[cutidx]].net);
+			for (auto cut_node : match.leaves()) {
+				assert(pol_net(cut_node, local_map.ic(cutidx)));
+				stan->connect(gate, inports[local_map.p(cutidx)], pol_net(cut_node, local_map.ic(cutidx)));
 				cutidx++;
 			}
 
 			snprintf(buf, sizeof(buf), "_%08d_%s", autoidx++, outport->name());
-			node->pol[C].net = stan->makeNet(buf, top);
-			stan->connect(gate, outport, node->pol[C].net);
+			pol_net(node, C) = stan->makeNet(buf, top);
+			stan->connect(gate, outport, pol_net(node, C));
 		}
 
 		// only visit POs with valid mapping (those will have map_fouts set)
 		for (auto node : nodes)
-		if (node->po && node->pol[0].map_fouts) {
-			auto &match = node->matches[node->pol[0].sel];
-			CutList cut_list{match.cut};
+		if (node->po && pols(node)[0].map_fouts) {
+			auto &match = node->match(pols(node)[0].sel);
+			CutList cut_list = match.leaves();
 			if (!cut_list.size) {
 				if (node->ins[0].eval() && node->ins[1].eval())
-					stan->mergeInto(node->net, one);
+					stan->mergeInto(port_net(node), one);
 				else
-					stan->mergeInto(node->net, zero);
+					stan->mergeInto(port_net(node), zero);
 			} else {
-				assert(node->ins[0].node && !node->ins[1].node);
+				assert(!node->ins[0].is_const() && node->ins[1].is_const());
 				assert(node->ins[1].eval());
 				assert(cut_list.size == 1);
-				assert(match.cut[0]->pol[node->ins[0].negated].net);
-				stan->mergeInto(node->net, match.cut[0]->pol[node->ins[0].negated].net);
+				AndNode *driver = AndNode::at(match.cut()[0]);
+				assert(pol_net(driver, node->ins[0].negated()));
+				stan->mergeInto(port_net(node), pol_net(driver, node->ins[0].negated()));
 			}
 		}
 	}
@@ -2006,12 +4136,13 @@ extern const char *pressmold_swig_tcl_inits[];
 
 Network net;
 
-void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve)
+void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve, bool adaptive,
+					int threads)
 {
 	if (max_cut == -1)
-		max_cut = CUT_MAXIMUM;
+		max_cut = CUT_DEFAULT;
 
-	net.prepare_cuts(cuts, matches, max_cut, apply_sieve);
+	net.prepare_cuts(Network::CutParams{cuts, matches, max_cut, apply_sieve, adaptive}, threads);
 }
 
 void mapping_round_cmd(const char *kind, float param, bool param2)
@@ -2042,10 +4173,10 @@ void mapping_round_cmd(const char *kind, float param, bool param2)
 
 	for (auto node : net.nodes)
 	for (int C = 0; C < 2; C++) {
-		if (node->pi || node->po || !node->pol[C].map_fouts)
+		if (node->pi || node->po || !net.pols(node)[C].map_fouts)
 			continue;
 		ncells++;
-		nedges += CutList{node->matches[node->pol[C].sel].cut}.size;
+		nedges += node->match(net.pols(node)[C].sel).size;
 	}
 
 	printf("%6s  A=%8.1f  N=%5d  E=%5d", kind, area, ncells, nedges);
@@ -2066,9 +4197,9 @@ void report_mapping()
 	std::map<sta::LibertyCell *, int> cell_number;
 	for (auto node : net.nodes)
 	for (int C = 0; C < 2; C++)
-	if (!node->pi && !node->po && node->pol[C].map_fouts) {
-		assert(node->pol[C].sel_target);
-		cell_number[node->pol[C].sel_target->cell]++;
+	if (!node->pi && !node->po && net.pols(node)[C].map_fouts) {
+		assert(net.pols(node)[C].sel_target);
+		cell_number[net.pols(node)[C].sel_target->cell]++;
 	}
 
 	printf("\n");
@@ -2093,9 +4224,9 @@ void extract_mapping()
 	sta::Sta::sta()->networkChanged();
 }
 
-uint64_t fexpr_eval(sta::FuncExpr &fexpr, std::vector<sta::LibertyPort *> ins)
+truth8 fexpr_eval(sta::FuncExpr &fexpr, std::vector<sta::LibertyPort *> ins)
 {
-	uint64_t mask = ((uint64_t) 2 << ((1 << ins.size()) - 1)) - 1;
+	truth8 mask = truth8::mask(ins.size());
 
 	switch (fexpr.op()) {
 	case sta::FuncExpr::op_port: {
@@ -2104,10 +4235,10 @@ uint64_t fexpr_eval(sta::FuncExpr &fexpr, std::vector<sta::LibertyPort *> ins)
 			if (ins[i] == fexpr.port())
 				break;
 		assert(i != (int) ins.size());
-		uint64_t ret = 0;
+		truth8 ret;
 		for (int j = 0; j < 1 << ins.size(); j++)
 			if (j & 1 << i)
-				ret |= (truth6) 1 << j;
+				ret.w[j / 64] |= (truth6) 1 << (j % 64);
 		return ret;
 	}
 	case sta::FuncExpr::op_not:  return mask & ~fexpr_eval(*fexpr.left(), ins);
@@ -2115,7 +4246,7 @@ uint64_t fexpr_eval(sta::FuncExpr &fexpr, std::vector<sta::LibertyPort *> ins)
 	case sta::FuncExpr::op_and:  return fexpr_eval(*fexpr.left(), ins) & fexpr_eval(*fexpr.right(), ins);
 	case sta::FuncExpr::op_xor:  return fexpr_eval(*fexpr.left(), ins) ^ fexpr_eval(*fexpr.right(), ins);
 	case sta::FuncExpr::op_one:  return mask;
-	case sta::FuncExpr::op_zero: return 0;
+	case sta::FuncExpr::op_zero: return truth8();
 	default: abort();
 	}
 }
@@ -2189,11 +4320,11 @@ bool register_cell_cmd(sta::LibertyCell *cell, bool verbose)
 			outputs[0]->function() &&
 			outputs[1]->function()) {
 		sta::LibertyPort *hi = nullptr, *lo = nullptr;
-		if (fexpr_eval(*outputs[0]->function(), inputs))
+		if (fexpr_eval(*outputs[0]->function(), inputs).w[0])
 			hi = outputs[0];
 		else
 			lo = outputs[0];
-		if (fexpr_eval(*outputs[1]->function(), inputs))
+		if (fexpr_eval(*outputs[1]->function(), inputs).w[0])
 			hi = outputs[1];
 		else
 			lo = outputs[1];
@@ -2208,16 +4339,21 @@ bool register_cell_cmd(sta::LibertyCell *cell, bool verbose)
 		}
 	}
 
-	if (outputs.size() != 1 || !outputs[0]->function() || inputs.size() > 6) {
+	if (outputs.size() != 1 || !outputs[0]->function() || inputs.size() > CUT_MAXIMUM) {
 		if (verbose)
 			printf("Ignoring cell %s\n", cell->name());
 		return false;
 	}
 
-	truth6 print = fexpr_eval(*outputs[0]->function(), inputs);
-	std::set<truth6> seen;
+	truth8 wide_print = fexpr_eval(*outputs[0]->function(), inputs);
+	truth6 print = wide_print.w[0];
 	if (verbose) {
-		printf("Registering %s: fingerprint %llx\n inputs: ", cell->name(), print);
+		int top = inputs.size() > 6 ? (1 << (inputs.size() - 6)) - 1 : 0;
+		printf("Registering %s: fingerprint %llx", cell->name(),
+			   (unsigned long long) wide_print.w[top]);
+		for (int i = top - 1; i >= 0; i--)
+			printf("%016llx", (unsigned long long) wide_print.w[i]);
+		printf("\n inputs: ");
 		for (auto port : inputs)
 			printf("%s ", port->busName());
 		printf("\n");
@@ -2230,8 +4366,15 @@ bool register_cell_cmd(sta::LibertyCell *cell, bool verbose)
 			target_index.inv_cell = cell;
 	}
 
+	if (inputs.size() > 6) {
+		npn_semiclass_allrepr(wide_print, inputs.size(), [&](truth8 repr, NPN &npn) {
+			target_index.class_targets(repr, inputs.size()).push_back(Target{ cell, npn.inv() });
+		});
+		return true;
+	}
+
 	npn_semiclass_allrepr(print, inputs.size(), [&](truth6 repr, NPN &npn) {
-		target_index.classes[std::make_pair(repr, inputs.size())].push_back(Target{ cell, npn.inv() });
+		target_index.class_targets(truth8(repr), inputs.size()).push_back(Target{ cell, npn.inv() });
 	});
 
 	return true;
@@ -2243,7 +4386,8 @@ void prune_targets_cmd()
 
 	int tally_old = 0, tally_new = 0;
 
-	for (auto &[key, target_list] : target_index.classes) {
+	for (auto &cls : target_index.classes) {
+		auto &target_list = cls.targets;
 		std::sort(target_list.begin(), target_list.end(),
 			[](Target &a, Target &b) {
 				return std::make_pair(a.map.c_fingerprint(), a.cell->area())
@@ -2262,13 +4406,46 @@ void prune_targets_cmd()
 }
 
 // TODO: error handling
-void read_aiger_cmd(const char *filename, const char *name)
+void read_aiger_cmd(const char *filename, const char *name, bool strash, bool prepare,
+					int cuts, int matches, int max_cut, bool apply_sieve)
+{
+	if (max_cut == -1)
+		max_cut = CUT_DEFAULT;
+
+	Network::CutParams params{cuts, matches, max_cut, apply_sieve, false};
+	auto file = std::make_unique<MappedFile>(filename);
+	sta::ConcreteNetwork *stan = (sta::ConcreteNetwork *) sta::Sta::sta()->networkReader();
+	// the network being read gets attached in the meantime
+	Network::AttachGuard guard{net};
+	net = Network::read_aiger(std::move(file), stan, name, filename,
+							  prepare ? &params : NULL, strash);
+}
+
+void write_cut_checkpoint_cmd(const char *filename)
 {
-	std::ifstream f(filename, std::ios::binary);
+	std::ofstream f(filename, std::ios::binary);
 	if (!f.is_open())
 		throw std::runtime_error(std::string("Failed to open ") + filename + "\n");
-	sta::ConcreteNetwork *stan = (sta::ConcreteNetwork *) sta::Sta::sta()->networkReader();
-	net = Network::read_aiger(f, stan, name);
+	net.write_cut_checkpoint(f);
+}
+
+void read_cut_checkpoint_cmd(const char *filename)
+{
+	MappedFile file(filename);
+	net.read_cut_checkpoint(file);
+}
+
+void write_aiger_cmd(const char *filename, bool with_mapping)
+{
+	std::ofstream f(filename, std::ios::binary);
+	if (!f.is_open())
+		throw std::runtime_error(std::string("Failed to open ") + filename + "\n");
+	net.write_aiger(f, with_mapping);
+}
+
+void restore_mapping_cmd()
+{
+	net.restore_mapping();
 }
 
 void write_aig_verilog(const char *filename, const char *module_name)
@@ -2283,9 +4460,9 @@ void portlist_cmd()
 {
 	for (auto node : net.nodes) {
 		if (node->pi)
-			printf("input %s\n", node->label.c_str());
+			printf("input %s\n", net.verilog_label(node).c_str());
 		if (node->po)
-			printf("output %s\n", node->label.c_str());
+			printf("output %s\n", net.verilog_label(node).c_str());
 	}
 }
 
@@ -2300,19 +4477,154 @@ void lose_choices()
 	net.consolidate();
 }
 
-void sieve_cmd(bool dump, bool record, bool clear)
+void strash_cmd()
+{
+	net.consolidate(true);
+}
+
+void match_arena_cmd(int huge_pages, bool release)
+{
+	if (huge_pages != -1)
+		MatchArena::huge_pages = huge_pages;
+
+	if (release) {
+		// the matches go away along with the memory
+		net.invalidate_matches();
+		net.match_arena.release();
+		net.worker_arenas.clear();
+	}
+
+	printf("Match arena: %.2f MiB in use, %.2f MiB mapped%s\n",
+		   (float) net.match_arena_used() / (1024 * 1024),
+		   (float) net.match_arena_footprint() / (1024 * 1024),
+		   MatchArena::huge_pages ? ", huge pages" : "");
+}
+
+void sieve_cmd(bool dump, bool record, bool clear, const char *load)
 {
 	if (dump) {
-		for (auto f : sieve)
-			printf("0x%016llx,\n", f);	
+		for (auto f : sieve.sorted())
+			printf("0x%016llx,\n", (unsigned long long) f);
 	}
 
 	if (clear)
 		sieve.clear();
 
+	if (*load)
+		sieve.load(load);
+
 	sieve_recording = record;
 }
 
+// Reads in a design for record_design(), leaving out the choices as
+// they would take the cuts outside of the plain fanin cones
+static Network read_design(const std::string &path, int &frontier_size)
+{
+	Network design = Network::read_aiger(std::make_unique<MappedFile>(path.c_str()),
+										 NULL, "top", path.c_str());
+
+	for (auto node : design.nodes) {
+		if (node->sibling) {
+			design.lose_choices();
+			design.consolidate();
+			break;
+		}
+	}
+
+	frontier_size = design.frontier();
+	return design;
+}
+
+// Tallies the functions within the matches found in one design. It
+// doesn't print and touches nothing but the design and `recording`, so
+// designs can be processed from several threads at once.
+static void record_design(Network &design, const Network::CutParams &params,
+						  int frontier_size, SieveRecording &recording)
+{
+	design.attach();
+	auto enumerator = Network::make_enumerator(design, params, frontier_size);
+	enumerator->recording = &recording;
+	for (auto node : design.nodes)
+		enumerator->visit(node);
+}
+
+// The batch learning of the sieve. It's a session command rather than a
+// tool of its own because what gets tallied are the cones of matches,
+// which takes the cells registered from the Liberty libraries in the
+// session.
+void learn_sieve_cmd(const char *dirname, const char *filename, int threads, float coverage,
+					 int cuts, int matches, int max_cut)
+{
+	if (max_cut == -1)
+		max_cut = CUT_DEFAULT;
+
+	Network::CutParams params{cuts, matches, max_cut, false, false};
+	Network::CutEnumeratorBase::check_params(params);
+	if (!(coverage > 0 && coverage <= 1))
+		throw std::runtime_error("Coverage out of range");
+	if (target_index.classes.empty())
+		throw std::runtime_error("No cells registered");
+
+	std::vector<std::string> paths;
+	for (auto &entry : std::filesystem::directory_iterator(dirname)) {
+		if (entry.is_regular_file() && entry.path().extension() == ".aig")
+			paths.push_back(entry.path().string());
+	}
+	std::sort(paths.begin(), paths.end());
+	if (paths.empty())
+		throw std::runtime_error(std::string("No AIGER files in ") + dirname);
+
+	std::ofstream f(filename);
+	if (!f.is_open())
+		throw std::runtime_error(std::string("Failed to open ") + filename + "\n");
+
+	if (threads < 1)
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, (int) paths.size());
+
+	// reading the designs attaches them on this thread
+	Network::AttachGuard guard{net};
+
+	// The designs are read in on this thread, which does all the
+	// printing, and then enumerated a batch of `threads` at a time,
+	// each thread tallying apart
+	std::vector<SieveRecording> recordings(threads);
+	for (size_t base = 0; base < paths.size(); base += threads) {
+		size_t nbatch = std::min((size_t) threads, paths.size() - base);
+		std::vector<Network> batch;
+		std::vector<int> frontier_sizes(nbatch);
+		batch.reserve(nbatch);
+		for (size_t i = 0; i < nbatch; i++)
+			batch.push_back(read_design(paths[base + i], frontier_sizes[i]));
+
+		std::exception_ptr error;
+		std::mutex error_mutex;
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < nbatch; i++) {
+			workers.emplace_back([&, i]() {
+				try {
+					record_design(batch[i], params, frontier_sizes[i], recordings[i]);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (!error)
+						error = std::current_exception();
+				}
+			});
+		}
+		for (auto &worker : workers)
+			worker.join();
+		if (error)
+			std::rethrow_exception(error);
+		printf("Recorded %zu of %zu designs\n", base + nbatch, paths.size());
+	}
+
+	SieveRecording merged;
+	for (auto &recording : recordings)
+		merged.merge(recording);
+	printf("Recorded %zu designs with %d threads\n", paths.size(), threads);
+	merged.write(f, coverage);
+}
+
 static int tcl_main(Tcl_Interp *interp)
 {
 	int ret;
@@ -12,8 +12,14 @@
 	#include "commands.h"	
 %}
 extern bool register_cell_cmd(LibertyCell *cell, bool verbose);
-extern void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve);
-extern void read_aiger_cmd(const char *filename, const char *name);
+extern void prepare_cuts_cmd(int cuts, int matches, int max_cut, bool apply_sieve, bool adaptive,
+					int threads);
+extern void read_aiger_cmd(const char *filename, const char *name, bool strash, bool prepare,
+					int cuts, int matches, int max_cut, bool apply_sieve);
+extern void write_cut_checkpoint_cmd(const char *filename);
+extern void read_cut_checkpoint_cmd(const char *filename);
+extern void write_aiger_cmd(const char *filename, bool with_mapping);
+extern void restore_mapping_cmd();
 extern void portlist_cmd();
 extern void write_aig_verilog(const char *filename, const char *module_name);
 extern void report_mapping();
@@ -23,4 +29,8 @@ extern void report_aig();
 extern void lose_choices();
 extern void report_sibling_usage();
 extern void prune_targets_cmd();
-extern void sieve_cmd(bool dump, bool record, bool clear);
+extern void strash_cmd();
+extern void match_arena_cmd(int huge_pages, bool release);
+extern void sieve_cmd(bool dump, bool record, bool clear, const char *load);
+extern void learn_sieve_cmd(const char *dirname, const char *filename, int threads, float coverage,
+					int cuts, int matches, int max_cut);
@@ -50,11 +50,11 @@ proc check_equivalence {path} {
 }
 
 sta::define_cmd_args "prepare_cuts" \
-	{[-cuts cuts_limit] [-matches matches_limit] [-max_cut max_cut] [-sieve]}
+	{[-cuts cuts_limit] [-matches matches_limit] [-max_cut max_cut] [-sieve] [-adaptive] [-threads threads]}
 proc prepare_cuts {args} {
 	sta::parse_key_args "prepare_cuts" args \
-		keys {-cuts -matches -max_cut} \
-		flags {-sieve}
+		keys {-cuts -matches -max_cut -threads} \
+		flags {-sieve -adaptive}
 
 	if {[info exists keys(-matches)]} {
 		set matches $keys(-matches)
@@ -75,7 +75,37 @@ proc prepare_cuts {args} {
 		set max_cut -1
 	}
 
-	sta::prepare_cuts_cmd $cuts $matches $max_cut [info exists flags(-sieve)]
+	if {[info exists keys(-threads)]} {
+		set threads $keys(-threads)
+	} else {
+		set threads 1
+	}
+
+	sta::prepare_cuts_cmd $cuts $matches $max_cut [info exists flags(-sieve)] \
+		[info exists flags(-adaptive)] $threads
+}
+
+sta::define_cmd_args "match_arena" {[-huge_pages 0|1] [-release]}
+proc match_arena {args} {
+	sta::parse_key_args "match_arena" args \
+		keys {-huge_pages} \
+		flags {-release}
+
+	if {[info exists keys(-huge_pages)]} {
+		set huge_pages $keys(-huge_pages)
+	} else {
+		set huge_pages -1
+	}
+
+	sta::match_arena_cmd $huge_pages [info exists flags(-release)]
+}
+
+proc write_cut_checkpoint {path} {
+	sta::write_cut_checkpoint_cmd $path
+}
+
+proc read_cut_checkpoint {path} {
+	sta::read_cut_checkpoint_cmd $path
 }
 
 sta::define_cmd_args "develop_mapping" \
@@ -156,8 +186,56 @@ proc develop_mapping {args} {
 	puts ""
 }
 
-proc read_aiger {path} {
-	sta::read_aiger_cmd "$path" "top"
+# With -prepare_cuts the cuts are enumerated while the file is decoded.
+# The fanouts aren't known yet then, so the area flow the priority cuts
+# and matches are ranked by isn't divided among them and the same limits
+# give different, usually lower-quality, cuts than a separate
+# prepare_cuts. The per-node cut caches are kept for the whole network,
+# where prepare_cuts only keeps them along the frontier, so the peak
+# memory is higher too.
+sta::define_cmd_args "read_aiger" \
+	{[-strash] [-prepare_cuts] [-cuts cuts_limit] [-matches matches_limit] [-max_cut max_cut] [-sieve] path}
+proc read_aiger {args} {
+	sta::parse_key_args "read_aiger" args \
+		keys {-cuts -matches -max_cut} \
+		flags {-strash -prepare_cuts -sieve}
+	sta::check_argc_eq1 "read_aiger" $args
+
+	if {[info exists keys(-matches)]} {
+		set matches $keys(-matches)
+	} else {
+		set matches 16
+	}
+
+	if {[info exists keys(-cuts)]} {
+		set cuts $keys(-cuts)
+	} else {
+		set cuts 64
+	}
+
+	if {[info exists keys(-max_cut)]} {
+		set max_cut $keys(-max_cut)
+	} else {
+		set max_cut -1
+	}
+
+	sta::read_aiger_cmd [lindex $args 0] "top" [info exists flags(-strash)] \
+		[info exists flags(-prepare_cuts)] \
+		$cuts $matches $max_cut [info exists flags(-sieve)]
+}
+
+sta::define_cmd_args "write_aiger" {[-mapping] path}
+proc write_aiger {args} {
+	sta::parse_key_args "write_aiger" args \
+		keys {} \
+		flags {-mapping}
+	sta::check_argc_eq1 "write_aiger" $args
+
+	sta::write_aiger_cmd [lindex $args 0] [info exists flags(-mapping)]
+}
+
+proc restore_mapping {} {
+	sta::restore_mapping_cmd
 }
 
 proc extract_mapping {} {
@@ -172,6 +250,10 @@ proc lose_choices {} {
 	sta::lose_choices
 }
 
+proc strash {} {
+	sta::strash_cmd
+}
+
 proc report_mapping {} {
 	sta::report_mapping
 }
@@ -191,10 +273,61 @@ proc prune_targets {} {
 }
 
 sta::define_cmd_args "sieve" \
-	{[-dump] [-record] [-clear]}
+	{[-dump] [-record] [-clear] [-load path]}
 proc sieve {args} {
 	sta::parse_key_args "sieve" args \
-		keys {} \
+		keys {-load} \
 		flags {-dump -record -clear}
-	sta::sieve_cmd [info exists flags(-dump)] [info exists flags(-record)] [info exists flags(-clear)]
+
+	if {[info exists keys(-load)]} {
+		set load $keys(-load)
+	} else {
+		set load ""
+	}
+
+	sta::sieve_cmd [info exists flags(-dump)] [info exists flags(-record)] [info exists flags(-clear)] \
+		$load
+}
+
+sta::define_cmd_args "learn_sieve" \
+	{[-threads threads] [-coverage fraction] [-cuts cuts_limit] [-matches matches_limit] [-max_cut max_cut] aiger_dir sieve_path}
+proc learn_sieve {args} {
+	sta::parse_key_args "learn_sieve" args \
+		keys {-threads -coverage -cuts -matches -max_cut} \
+		flags {}
+	sta::check_argc_eq2 "learn_sieve" $args
+
+	if {[info exists keys(-threads)]} {
+		set threads $keys(-threads)
+	} else {
+		# one per hardware thread
+		set threads 0
+	}
+
+	if {[info exists keys(-coverage)]} {
+		set coverage $keys(-coverage)
+	} else {
+		set coverage 1.0
+	}
+
+	if {[info exists keys(-matches)]} {
+		set matches $keys(-matches)
+	} else {
+		set matches 16
+	}
+
+	if {[info exists keys(-cuts)]} {
+		set cuts $keys(-cuts)
+	} else {
+		set cuts 64
+	}
+
+	if {[info exists keys(-max_cut)]} {
+		set max_cut $keys(-max_cut)
+	} else {
+		set max_cut -1
+	}
+
+	sta::learn_sieve_cmd [lindex $args 0] [lindex $args 1] $threads $coverage \
+		$cuts $matches $max_cut
 }